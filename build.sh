@@ -6,15 +6,15 @@ set -xe
 DEBUG="-ggdb"
 
 CFLAGS="-Wall -Wextra $DEBUG `pkg-config --cflags raylib` `pkg-config --cflags fluidsynth`"
-LIBS="`pkg-config --libs raylib` `pkg-config --libs fluidsynth` -lm"
+LIBS="`pkg-config --libs raylib` `pkg-config --libs fluidsynth` -lm -lpthread"
 
 mkdir -p ./build
 
 #build the hot reload DLL
-clang $CFLAGS -o ./build/libplug.so -fPIC -shared ./src/plug.c $LIBS
+clang $CFLAGS -o ./build/libplug.so -fPIC -shared ./src/plug.c ./src/video_writer.c ./src/note_index.c ./src/profiler.c ./src/stress.c ./src/latency.c $LIBS
 
 # build with hot reload enabled
 clang $CFLAGS -DHOTRELOAD -o ./build/pianolizer ./src/hotreload.c ./src/main.c $LIBS
 
 #build with hot reload disabled (link at compile time)
-#clang $CFLAGS -o ./build/pianolizer ./src/plug.c ./src/main.c $LIBS
+#clang $CFLAGS -o ./build/pianolizer ./src/plug.c ./src/video_writer.c ./src/note_index.c ./src/profiler.c ./src/stress.c ./src/latency.c ./src/main.c $LIBS
@@ -9,6 +9,6 @@ set CFLAGS=-Wall -Wextra
 
 set DEPENDENCIES_DIR=./WinDependencies/
 set LIB_DIR=%DEPENDENCIES_DIR%bin/
-rem gcc %CFLAGS% -o %BUILD_DIR%pianolizer.exe  %SOURCE_DIR%main.c %SOURCE_DIR%plug.c %DEPENDENCIES_DIR%bin/libraylib.a %DEPENDENCIES_DIR%bin/libfluidsynth.dll.a -lopengl32 -lgdi32 -lwinmm
+rem gcc %CFLAGS% -o %BUILD_DIR%pianolizer.exe  %SOURCE_DIR%main.c %SOURCE_DIR%plug.c %SOURCE_DIR%video_writer.c %SOURCE_DIR%note_index.c %SOURCE_DIR%profiler.c %SOURCE_DIR%stress.c %SOURCE_DIR%latency.c %DEPENDENCIES_DIR%bin/libraylib.a %DEPENDENCIES_DIR%bin/libfluidsynth.dll.a -lopengl32 -lgdi32 -lwinmm -lpthread
 
-gcc %CFLAGS% -o %BUILD_DIR%pianolizer.exe  %SOURCE_DIR%main.c %SOURCE_DIR%plug.c -L%LIB_DIR% -lraylib -lfluidsynth -lopengl32 -lgdi32 -lwinmm -lm 
\ No newline at end of file
+gcc %CFLAGS% -o %BUILD_DIR%pianolizer.exe  %SOURCE_DIR%main.c %SOURCE_DIR%plug.c %SOURCE_DIR%video_writer.c %SOURCE_DIR%note_index.c %SOURCE_DIR%profiler.c %SOURCE_DIR%stress.c %SOURCE_DIR%latency.c -L%LIB_DIR% -lraylib -lfluidsynth -lopengl32 -lgdi32 -lwinmm -lm -lpthread 
\ No newline at end of file
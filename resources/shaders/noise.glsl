@@ -0,0 +1,52 @@
+#version 330
+
+// Shared by the key shaders, plug.c puts it in front of each of them
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+
+uniform float perlin_treshold;
+uniform float time;
+
+out vec4 finalColor;
+
+// Size of one noise cell in pixels, matches the old 5x5 cell Perlin texture on a 1080p monitor
+const vec2 cellSize = vec2(384.0, 216.0);
+const int octaves = 6;
+
+vec2 gradient(vec2 cell) {
+    float angle = 6.2831853 * fract(sin(dot(cell, vec2(127.1, 311.7))) * 43758.5453);
+    return vec2(cos(angle), sin(angle));
+}
+
+// Perlin gradient noise in [-1, 1]
+float perlin(vec2 pos) {
+    vec2 cell = floor(pos);
+    vec2 f = fract(pos);
+    vec2 u = f * f * f * (f * (f * 6.0 - 15.0) + 10.0);
+
+    float a = dot(gradient(cell + vec2(0.0, 0.0)), f - vec2(0.0, 0.0));
+    float b = dot(gradient(cell + vec2(1.0, 0.0)), f - vec2(1.0, 0.0));
+    float c = dot(gradient(cell + vec2(0.0, 1.0)), f - vec2(0.0, 1.0));
+    float d = dot(gradient(cell + vec2(1.0, 1.0)), f - vec2(1.0, 1.0));
+
+    return mix(mix(a, b, u.x), mix(c, d, u.x), u.y);
+}
+
+// Same fractal sum as GenImagePerlinNoise: lacunarity 2, gain 0.5
+float fbm(vec2 pos) {
+    float sum = 0.0;
+    float amplitude = 1.0;
+    for (int i = 0; i < octaves; i++) {
+        sum += perlin(pos) * amplitude;
+        pos *= 2.0;
+        amplitude *= 0.5;
+    }
+    return sum;
+}
+
+float noise() {
+    vec2 offset = vec2(sin(time) * 320.0, cos(time) * 180.0);
+    return clamp((fbm((gl_FragCoord.xy + offset) / cellSize) + 1.0) / 2.0, 0.0, 1.0);
+}
@@ -1,21 +1,8 @@
-#version 330
-
-in vec2 fragTexCoord;
-in vec4 fragColor;
-
-
-uniform sampler2D texture0;
-uniform vec4 colDiffuse;
-
-uniform float perlin_treshold;
-
-out vec4 finalColor;
-
+// Follows noise.glsl, which declares the uniforms and noise()
 
 void main() {
-    vec4 noiseColor = texture(texture0, fragTexCoord);
-   
-    float brightness = (noiseColor.x + noiseColor.y + noiseColor.z) / 3;
+    float brightness = noise();
+    vec4 noiseColor = vec4(brightness, brightness, brightness, 1);
 
     if (brightness > perlin_treshold) {
         finalColor = noiseColor;
@@ -0,0 +1,43 @@
+#include "latency.h"
+
+void latency_init(LatencyHistogram *histogram) {
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) atomic_init(&histogram->counts[i], 0);
+    atomic_init(&histogram->max_usec, 0);
+}
+
+void latency_record(LatencyHistogram *histogram, double seconds) {
+    unsigned usec = seconds > 0.0 ? (unsigned) (seconds * 1e6) : 0;
+    size_t bucket = usec / LATENCY_BUCKET_USEC;
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+    atomic_fetch_add_explicit(&histogram->counts[bucket], 1, memory_order_relaxed);
+
+    unsigned max = atomic_load_explicit(&histogram->max_usec, memory_order_relaxed);
+    while (usec > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max_usec, &max, usec,
+                                                  memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+size_t latency_count(LatencyHistogram *histogram) {
+    size_t count = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        count += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    return count;
+}
+
+double latency_percentile(LatencyHistogram *histogram, double q) {
+    size_t total = latency_count(histogram);
+    if (total == 0) return 0.0;
+
+    size_t rank = (size_t) (q * (double) (total - 1)) + 1;
+    size_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen >= rank) return (double) ((i + 1) * LATENCY_BUCKET_USEC) * 1e-6;
+    }
+    return latency_max(histogram);
+}
+
+double latency_max(LatencyHistogram *histogram) {
+    return atomic_load_explicit(&histogram->max_usec, memory_order_relaxed) * 1e-6;
+}
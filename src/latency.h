@@ -0,0 +1,24 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define LATENCY_BUCKET_USEC 250
+#define LATENCY_BUCKETS 400             // up to 100 ms, anything slower lands in the last bucket
+
+// Filled from any thread without locks, read by the render loop
+typedef struct {
+    atomic_uint counts[LATENCY_BUCKETS];
+    atomic_uint max_usec;
+} LatencyHistogram;
+
+void latency_init(LatencyHistogram *histogram);
+void latency_record(LatencyHistogram *histogram, double seconds);
+
+size_t latency_count(LatencyHistogram *histogram);
+// Upper edge of the bucket holding the q quantile (0..1), in seconds, 0 without samples
+double latency_percentile(LatencyHistogram *histogram, double q);
+double latency_max(LatencyHistogram *histogram);
+
+#endif // LATENCY_H_
@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #ifdef _WIN32
 #include "../WinDependencies/include/raylib.h"
 #else
@@ -6,19 +9,224 @@
 #endif
 #include "hotreload.h"
 
+#define DEFAULT_EXPORT_FPS 60
+#define DEFAULT_STRESS_RESULTS "stress_results.csv"
 
-int main(void) {
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "    --midi <file.mid>         play this file right away, or the files of a .m3u playlist one after another\n");
+    fprintf(stderr, "    --soundfont <file.sf2>    load this soundfont right away\n");
+    fprintf(stderr, "    --export-video <file>     render --midi offline into a .y4m or raw RGBA file (- for stdout) and quit\n");
+    fprintf(stderr, "    --export-audio <file>     render --midi offline into a .wav/.flac file (with --export-video: its soundtrack) and quit\n");
+    fprintf(stderr, "    --export-events <file>    with an export: write every note event with its sample position as CSV\n");
+    fprintf(stderr, "    --midi-input              play notes from MIDI devices (pick the driver with midi.driver in --config)\n");
+    fprintf(stderr, "    --midi-input-replay <file.mid>  feed this file through the MIDI input path as if it were a device\n");
+    fprintf(stderr, "    --falling-notes           show upcoming notes falling onto the keys (toggle with F)\n");
+    fprintf(stderr, "    --sim-thread              advance keys, rects and animation on their own thread at a fixed rate\n");
+    fprintf(stderr, "    --latency <profile>       audio buffering: ultra-low, balanced or safe (default: fluidsynth's defaults)\n");
+    fprintf(stderr, "    --av-offset <ms>          how long the visuals wait for the audio to be heard, or auto: the driver buffers\n");
+    fprintf(stderr, "    --config <file>           fluidsynth settings as name = value lines, applied over the profile\n");
+    fprintf(stderr, "    --audio-driver <name>     fluidsynth audio driver (alsa, pulseaudio, jack, wasapi, ...)\n");
+    fprintf(stderr, "    --period-size <n>         samples per audio block\n");
+    fprintf(stderr, "    --periods <n>             audio blocks buffered by the driver\n");
+    fprintf(stderr, "    --sample-rate <hz>        synth sample rate\n");
+    fprintf(stderr, "    --dynamic-samples         load only the samples of the presets the piece plays (synth.dynamic-sample-loading)\n");
+    fprintf(stderr, "    --soundfont-budget <mb>   keep unused soundfonts loaded while their files fit in this, least recently used go first\n");
+    fprintf(stderr, "    --cpu-cores <n>           render voices on n threads (synth.cpu-cores)\n");
+    fprintf(stderr, "    --benchmark-cores <n>     render --midi offline with 1..n cores, report how they scale and quit\n");
+    fprintf(stderr, "    --stress <spec>           play generated notes instead of a midi file and record how the frames hold up, spec is\n");
+    fprintf(stderr, "                              default or key=value,... with nps, ramp, chord, keys=<low>-<high>, length, trill=<key>,\n");
+    fprintf(stderr, "                              duration and seed\n");
+    fprintf(stderr, "    --stress-results <file>   where --stress writes its per frame CSV (default %s)\n", DEFAULT_STRESS_RESULTS);
+    fprintf(stderr, "    --fps <n>                 frame rate of the exported video (default %d)\n", DEFAULT_EXPORT_FPS);
+    fprintf(stderr, "    --size <width>x<height>   window / video size\n");
+}
 
-    if (!reload_libplug()) return 1;
+static bool parse_options(int argc, char **argv, PlugOptions *options, int *width, int *height) {
+    options->fps = DEFAULT_EXPORT_FPS;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            usage(argv[0]);
+            return false;
+        }
+        if (strcmp(arg, "--falling-notes") == 0) {
+            options->falling_notes = true;
+            continue;
+        }
+        if (strcmp(arg, "--midi-input") == 0) {
+            options->midi_input = true;
+            continue;
+        }
+        if (strcmp(arg, "--dynamic-samples") == 0) {
+            options->dynamic_samples = true;
+            continue;
+        }
+        if (strcmp(arg, "--sim-thread") == 0) {
+            options->sim_thread = true;
+            continue;
+        }
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: missing value for %s\n", arg);
+            usage(argv[0]);
+            return false;
+        }
+
+        if (strcmp(arg, "--midi") == 0) {
+            options->midi_path = value;
+        } else if (strcmp(arg, "--soundfont") == 0) {
+            options->soundfont_path = value;
+        } else if (strcmp(arg, "--export-video") == 0) {
+            options->video_path = value;
+        } else if (strcmp(arg, "--export-audio") == 0) {
+            options->audio_path = value;
+        } else if (strcmp(arg, "--export-events") == 0) {
+            options->events_path = value;
+        } else if (strcmp(arg, "--midi-input-replay") == 0) {
+            options->midi_input_replay = value;
+        } else if (strcmp(arg, "--latency") == 0) {
+            options->latency_profile = value;
+        } else if (strcmp(arg, "--av-offset") == 0) {
+            options->av_offset = value;
+        } else if (strcmp(arg, "--config") == 0) {
+            options->config_path = value;
+        } else if (strcmp(arg, "--audio-driver") == 0) {
+            options->audio_driver = value;
+        } else if (strcmp(arg, "--period-size") == 0) {
+            options->period_size = atoi(value);
+        } else if (strcmp(arg, "--periods") == 0) {
+            options->periods = atoi(value);
+        } else if (strcmp(arg, "--sample-rate") == 0) {
+            options->sample_rate = atof(value);
+        } else if (strcmp(arg, "--soundfont-budget") == 0) {
+            options->soundfont_budget_mb = atoi(value);
+        } else if (strcmp(arg, "--cpu-cores") == 0) {
+            options->cpu_cores = atoi(value);
+        } else if (strcmp(arg, "--benchmark-cores") == 0) {
+            options->benchmark_cores = atoi(value);
+        } else if (strcmp(arg, "--stress") == 0) {
+            options->stress_spec = value;
+        } else if (strcmp(arg, "--stress-results") == 0) {
+            options->stress_results_path = value;
+        } else if (strcmp(arg, "--fps") == 0) {
+            options->fps = atoi(value);
+        } else if (strcmp(arg, "--size") == 0) {
+            if (sscanf(value, "%dx%d", width, height) != 2) {
+                fprintf(stderr, "ERROR: invalid size %s, expected <width>x<height>\n", value);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "ERROR: unknown option %s\n", arg);
+            usage(argv[0]);
+            return false;
+        }
+        i++;
+    }
+
+    bool exporting = options->video_path != NULL || options->audio_path != NULL;
+    if (exporting && options->midi_path == NULL) {
+        fprintf(stderr, "ERROR: --export-video and --export-audio need a --midi file\n");
+        return false;
+    }
+    if (options->events_path != NULL && !exporting) {
+        fprintf(stderr, "ERROR: --export-events only works together with --export-video or --export-audio\n");
+        return false;
+    }
+    if (options->stress_spec != NULL && (exporting || options->midi_path != NULL)) {
+        fprintf(stderr, "ERROR: --stress plays its own notes and cannot be combined with --midi or an export\n");
+        return false;
+    }
+    if (options->stress_results_path != NULL && options->stress_spec == NULL) {
+        fprintf(stderr, "ERROR: --stress-results only works together with --stress\n");
+        return false;
+    }
+    if (options->stress_spec != NULL && options->stress_results_path == NULL) {
+        options->stress_results_path = DEFAULT_STRESS_RESULTS;
+    }
+    if (options->midi_input && options->midi_input_replay != NULL) {
+        fprintf(stderr, "ERROR: --midi-input and --midi-input-replay are two sources for the same input, pick one\n");
+        return false;
+    }
+    if ((options->midi_input || options->midi_input_replay != NULL) && exporting) {
+        fprintf(stderr, "ERROR: MIDI input only works live, not in an export\n");
+        return false;
+    }
+    if (options->sim_thread && exporting) {
+        fprintf(stderr, "ERROR: --sim-thread only works live, an export steps the simulation with its frames\n");
+        return false;
+    }
+    if (options->benchmark_cores != 0 && (options->benchmark_cores < 1 || options->midi_path == NULL || exporting)) {
+        fprintf(stderr, "ERROR: --benchmark-cores needs a positive number of cores and a --midi file, and no export\n");
+        return false;
+    }
+    if (options->av_offset != NULL && strcmp(options->av_offset, "auto") != 0) {
+        char *end = NULL;
+        double ms = strtod(options->av_offset, &end);
+        if (end == options->av_offset || *end != '\0' || ms < 0.0 || ms > 1000.0) {
+            fprintf(stderr, "ERROR: --av-offset takes auto or 0 to 1000 milliseconds\n");
+            return false;
+        }
+    }
+    if (options->soundfont_budget_mb < 0) {
+        fprintf(stderr, "ERROR: --soundfont-budget has to be positive\n");
+        return false;
+    }
+    if (options->cpu_cores < 0) {
+        fprintf(stderr, "ERROR: --cpu-cores has to be positive\n");
+        return false;
+    }
+    if (options->period_size < 0 || options->periods < 0 || options->sample_rate < 0.0) {
+        fprintf(stderr, "ERROR: period size, periods and sample rate have to be positive\n");
+        return false;
+    }
+    if (options->fps <= 0 || *width <= 0 || *height <= 0) {
+        fprintf(stderr, "ERROR: fps and size have to be positive\n");
+        return false;
+    }
+    return true;
+}
+
+// Keeps stdout clean when the exported video is streamed through it
+static void trace_log_to_stderr(int log_level, const char *text, va_list args) {
+    (void) log_level;
+    vfprintf(stderr, text, args);
+    fputc('\n', stderr);
+}
 
+int main(int argc, char **argv) {
     size_t factor = 80;
-    SetConfigFlags(FLAG_WINDOW_RESIZABLE);
-    InitWindow(factor*16, factor*9, "Pianolizer");
-    SetTargetFPS(60);
-    
-    plug_init();
+    int width = factor*16;
+    int height = factor*9;
+    PlugOptions options = {0};
+    if (!parse_options(argc, argv, &options, &width, &height)) return 1;
+
+    if (!reload_libplug()) return 1;
+
+    if (options.benchmark_cores > 0) {
+        return plug_benchmark(&options) ? 0 : 1;
+    }
+
+    // audio only export: no window and no audio device, so it runs on headless machines
+    if (options.audio_path != NULL && options.video_path == NULL) {
+        return plug_export_audio(&options) ? 0 : 1;
+    }
+
+    if (options.video_path != NULL) {
+        // offline export: nothing is shown and frames are produced as fast as possible
+        if (strcmp(options.video_path, "-") == 0) SetTraceLogCallback(trace_log_to_stderr);
+        SetConfigFlags(FLAG_WINDOW_HIDDEN);
+        InitWindow(width, height, "Pianolizer");
+    } else {
+        SetConfigFlags(FLAG_WINDOW_RESIZABLE);
+        InitWindow(width, height, "Pianolizer");
+        SetTargetFPS(60);
+    }
+
+    plug_init(&options);
 
-    while (!WindowShouldClose()) {
+    while (!WindowShouldClose() && !plug_finished()) {
         if (IsKeyPressed(KEY_R)) {
             void* state = plug_pre_reload();
             if (!reload_libplug()) return 1;
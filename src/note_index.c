@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "note_index.h"
+
+#define MIDI_CHANNELS 16
+#define MIDI_KEYS 128
+#define DEFAULT_USEC_PER_QUARTER 500000
+#define QUERY_STACK_SIZE 64
+#define QUERY_SCAN_LEVEL 3      // subtrees this small are scanned linearly
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    bool error;
+} Reader;
+
+// Notes and tempo changes in ticks, before the tempo map turns them into seconds
+typedef struct {
+    int start_tick;
+    int end_tick;
+    uint8_t key;
+    uint8_t velocity;
+    uint8_t channel;
+    uint8_t track;
+} TickNote;
+
+typedef struct {
+    TickNote *items;
+    size_t size;
+    size_t capacity;
+} TickNotes;
+
+typedef struct {
+    TempoChange *items;
+    size_t size;
+    size_t capacity;
+} TempoChanges;
+
+// Bank selects and program changes, which decide the preset of the notes after them on their channel
+typedef struct {
+    int tick;
+    double seconds;
+    uint8_t channel;
+    uint8_t controller;     // 0 for a bank select, 0xc0 for a program change
+    uint8_t value;
+} ProgramChange;
+
+typedef struct {
+    ProgramChange *items;
+    size_t size;
+    size_t capacity;
+} ProgramChanges;
+
+static uint8_t read_u8(Reader *r) {
+    if (r->pos >= r->size) {
+        r->error = true;
+        return 0;
+    }
+    return r->data[r->pos++];
+}
+
+static uint32_t read_u16be(Reader *r) {
+    uint32_t hi = read_u8(r);
+    return hi << 8 | read_u8(r);
+}
+
+static uint32_t read_u32be(Reader *r) {
+    uint32_t hi = read_u16be(r);
+    return hi << 16 | read_u16be(r);
+}
+
+static uint32_t read_varlen(Reader *r) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        uint8_t byte = read_u8(r);
+        value = value << 7 | (byte & 0x7f);
+        if (!(byte & 0x80)) return value;
+    }
+    r->error = true;
+    return value;
+}
+
+static void skip(Reader *r, size_t n) {
+    if (n > r->size - r->pos) {
+        r->error = true;
+        r->pos = r->size;
+        return;
+    }
+    r->pos += n;
+}
+
+static bool append_tick_note(TickNotes *arr, TickNote note) {
+    if (arr->size == arr->capacity) {
+        size_t capacity = arr->capacity == 0 ? 1024 : arr->capacity * 2;
+        TickNote *items = realloc(arr->items, capacity * sizeof(*items));
+        if (items == NULL) return false;
+        arr->items = items;
+        arr->capacity = capacity;
+    }
+    arr->items[arr->size++] = note;
+    return true;
+}
+
+static bool append_tempo_change(TempoChanges *arr, TempoChange change) {
+    if (arr->size == arr->capacity) {
+        size_t capacity = arr->capacity == 0 ? 16 : arr->capacity * 2;
+        TempoChange *items = realloc(arr->items, capacity * sizeof(*items));
+        if (items == NULL) return false;
+        arr->items = items;
+        arr->capacity = capacity;
+    }
+    arr->items[arr->size++] = change;
+    return true;
+}
+
+static bool append_program_change(ProgramChanges *arr, ProgramChange change) {
+    if (arr->size == arr->capacity) {
+        size_t capacity = arr->capacity == 0 ? 16 : arr->capacity * 2;
+        ProgramChange *items = realloc(arr->items, capacity * sizeof(*items));
+        if (items == NULL) return false;
+        arr->items = items;
+        arr->capacity = capacity;
+    }
+    arr->items[arr->size++] = change;
+    return true;
+}
+
+// Parses one MTrk chunk. Notes still held at the end of the track end there.
+static bool parse_track(Reader *r, uint8_t track, TickNotes *notes, TempoChanges *tempos, ProgramChanges *programs,
+                        int *last_tick) {
+    int open_start[MIDI_CHANNELS][MIDI_KEYS];
+    uint8_t open_velocity[MIDI_CHANNELS][MIDI_KEYS];
+    int tick = 0;
+    uint8_t running_status = 0;
+    bool ok = true;
+
+    for (size_t c = 0; c < MIDI_CHANNELS; c++) {
+        for (size_t k = 0; k < MIDI_KEYS; k++) open_start[c][k] = -1;
+    }
+
+    while (r->pos < r->size && !r->error) {
+        tick += read_varlen(r);
+        uint8_t status = read_u8(r);
+        if (status < 0x80) {
+            if (running_status == 0) break;
+            status = running_status;
+            r->pos--;
+        }
+
+        if (status == 0xff) {
+            uint8_t type = read_u8(r);
+            uint32_t len = read_varlen(r);
+            if (type == 0x51 && len == 3) {
+                TempoChange change = { .tick = tick };
+                change.usec_per_quarter = read_u8(r) << 16;
+                change.usec_per_quarter |= read_u8(r) << 8;
+                change.usec_per_quarter |= read_u8(r);
+                ok = ok && append_tempo_change(tempos, change);
+            } else {
+                skip(r, len);
+                if (type == 0x2f) break;
+            }
+            continue;
+        }
+        if (status == 0xf0 || status == 0xf7) {
+            skip(r, read_varlen(r));
+            running_status = 0;
+            continue;
+        }
+
+        running_status = status;
+        uint8_t type = status & 0xf0;
+        uint8_t channel = status & 0x0f;
+        uint8_t data1 = read_u8(r) & 0x7f;
+        uint8_t data2 = (type == 0xc0 || type == 0xd0) ? 0 : read_u8(r) & 0x7f;
+
+        if (type == 0x80 || type == 0x90) {
+            int *start = &open_start[channel][data1];
+            // a note on for a key that is already held ends the previous note, like the synth does
+            if (*start >= 0) {
+                TickNote note = {
+                    .start_tick = *start, .end_tick = tick, .key = data1,
+                    .velocity = open_velocity[channel][data1], .channel = channel, .track = track
+                };
+                ok = ok && append_tick_note(notes, note);
+                *start = -1;
+            }
+            if (type == 0x90 && data2 > 0) {
+                *start = tick;
+                open_velocity[channel][data1] = data2;
+            }
+        } else if (type == 0xc0 || (type == 0xb0 && data1 == 0)) {
+            ProgramChange change = {
+                .tick = tick, .channel = channel, .controller = type == 0xc0 ? 0xc0 : 0,
+                .value = type == 0xc0 ? data1 : data2
+            };
+            ok = ok && append_program_change(programs, change);
+        }
+    }
+
+    for (size_t c = 0; c < MIDI_CHANNELS; c++) {
+        for (size_t k = 0; k < MIDI_KEYS; k++) {
+            if (open_start[c][k] < 0) continue;
+            TickNote note = {
+                .start_tick = open_start[c][k], .end_tick = tick, .key = k,
+                .velocity = open_velocity[c][k], .channel = c, .track = track
+            };
+            ok = ok && append_tick_note(notes, note);
+        }
+    }
+
+    // a truncated track just ends early, like it does for fluidsynth's player
+    if (tick > *last_tick) *last_tick = tick;
+    return ok;
+}
+
+static int compare_tempo_changes(const void *a, const void *b) {
+    const TempoChange *ta = a;
+    const TempoChange *tb = b;
+    return (ta->tick > tb->tick) - (ta->tick < tb->tick);
+}
+
+static int compare_program_changes(const void *a, const void *b) {
+    const ProgramChange *pa = a;
+    const ProgramChange *pb = b;
+    return (pa->tick > pb->tick) - (pa->tick < pb->tick);
+}
+
+static int compare_notes(const void *a, const void *b) {
+    const Note *na = a;
+    const Note *nb = b;
+    if (na->start != nb->start) return (na->start > nb->start) - (na->start < nb->start);
+    return (na->key > nb->key) - (na->key < nb->key);
+}
+
+// Sorts the tempo changes of all tracks into one map starting at tick 0 and fills in their times
+static bool build_tempo_map(NoteIndex *index, TempoChanges *tempos) {
+    // qsort is not stable: with several changes on one tick, any of them may win
+    qsort(tempos->items, tempos->size, sizeof(*tempos->items), compare_tempo_changes);
+
+    index->tempo_map = malloc((tempos->size + 1) * sizeof(*index->tempo_map));
+    if (index->tempo_map == NULL) return false;
+
+    TempoChange *map = index->tempo_map;
+    size_t n = 0;
+    map[n++] = (TempoChange) { .tick = 0, .seconds = 0.0, .usec_per_quarter = DEFAULT_USEC_PER_QUARTER };
+    for (size_t i = 0; i < tempos->size; i++) {
+        TempoChange change = tempos->items[i];
+        if (change.tick == map[n - 1].tick) {
+            map[n - 1].usec_per_quarter = change.usec_per_quarter;
+            continue;
+        }
+        change.seconds = map[n - 1].seconds + (double) (change.tick - map[n - 1].tick) *
+                         map[n - 1].usec_per_quarter / (1e6 * index->division);
+        map[n++] = change;
+    }
+    index->n_tempo_changes = n;
+    return true;
+}
+
+// Replays the bank selects and program changes of all tracks alongside the notes in start order and keeps
+// every preset that plays at least one of them. A change on the tick of a note applies to that note.
+static bool collect_program_uses(NoteIndex *index, ProgramChanges *changes) {
+    uint8_t bank[MIDI_CHANNELS] = {0};
+    uint8_t program[MIDI_CHANNELS] = {0};
+    int last_listed[MIDI_CHANNELS];     // bank << 8 | program of the last note per channel, it is listed already
+    size_t capacity = 0;
+    size_t next = 0;
+
+    for (size_t c = 0; c < MIDI_CHANNELS; c++) last_listed[c] = -1;
+    qsort(changes->items, changes->size, sizeof(*changes->items), compare_program_changes);
+    for (size_t i = 0; i < changes->size; i++) {
+        changes->items[i].seconds = note_index_tick_to_seconds(index, changes->items[i].tick);
+    }
+
+    for (size_t i = 0; i < index->n_notes; i++) {
+        const Note *note = &index->notes[i];
+        // compared as floats like the note starts, so a change on the tick of a note applies to it
+        for (; next < changes->size && (float) changes->items[next].seconds <= note->start; next++) {
+            const ProgramChange *change = &changes->items[next];
+            if (change->controller == 0xc0) {
+                program[change->channel] = change->value;
+            } else {
+                bank[change->channel] = change->value;
+            }
+        }
+
+        uint8_t c = note->channel;
+        if (last_listed[c] == (bank[c] << 8 | program[c])) continue;
+        last_listed[c] = bank[c] << 8 | program[c];
+
+        bool listed = false;
+        for (size_t j = 0; j < index->n_programs && !listed; j++) {
+            const ProgramUse *use = &index->programs[j];
+            listed = use->channel == c && use->bank == bank[c] && use->program == program[c];
+        }
+        if (listed) continue;
+
+        if (index->n_programs == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            ProgramUse *programs = realloc(index->programs, capacity * sizeof(*programs));
+            if (programs == NULL) return false;
+            index->programs = programs;
+        }
+        index->programs[index->n_programs++] = (ProgramUse) {
+            .first_start = note->start, .channel = c, .bank = bank[c], .program = program[c]
+        };
+    }
+    return true;
+}
+
+// Fills max_end bottom up, level by level, as in cgranges' cr_index_core
+static int build_interval_tree(Note *notes, size_t n) {
+    size_t last_i = 0;
+    float last = 0.f;
+    int k;
+
+    if (n == 0) return -1;
+    for (size_t i = 0; i < n; i += 2) {
+        last_i = i;
+        last = notes[i].max_end = notes[i].end;
+    }
+    for (k = 1; (size_t) 1 << k <= n; k++) {
+        size_t x = (size_t) 1 << (k - 1);
+        size_t i0 = (x << 1) - 1;
+        size_t step = x << 2;
+        for (size_t i = i0; i < n; i += step) {
+            float left = notes[i - x].max_end;
+            float right = i + x < n ? notes[i + x].max_end : last;
+            float e = notes[i].end;
+            e = e > left ? e : left;
+            e = e > right ? e : right;
+            notes[i].max_end = e;
+        }
+        last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+        if (last_i < n && notes[last_i].max_end > last) last = notes[last_i].max_end;
+    }
+    return k - 1;
+}
+
+bool note_index_load(NoteIndex *index, const char *file_path) {
+    memset(index, 0, sizeof(*index));
+
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+    bool ok = data != NULL && fread(data, 1, size, f) == (size_t) size;
+    fclose(f);
+
+    ok = ok && note_index_load_mem(index, data, (size_t) size);
+    free(data);
+    return ok;
+}
+
+bool note_index_load_mem(NoteIndex *index, const uint8_t *data, size_t size) {
+    memset(index, 0, sizeof(*index));
+    bool ok = data != NULL && size > 0;
+
+    Reader r = { .data = data, .size = ok ? size : 0 };
+    TickNotes notes = {0};
+    TempoChanges tempos = {0};
+    ProgramChanges programs = {0};
+    int last_tick = 0;
+
+    if (ok) {
+        ok = read_u32be(&r) == 0x4d546864; // MThd
+        uint32_t header_len = read_u32be(&r);
+        read_u16be(&r);     // format, all three are merged the same way
+        uint32_t n_tracks = read_u16be(&r);
+        uint32_t division = read_u16be(&r);
+        ok = ok && header_len >= 6;
+        skip(&r, header_len - 6);
+        if (division & 0x8000) {
+            // SMPTE: negative frames per second in the high byte, ticks per frame in the low byte
+            int fps = -(int8_t) (division >> 8);
+            index->ticks_per_second = (double) fps * (division & 0xff);
+            index->division = division & 0xff;
+        } else {
+            index->division = division;
+        }
+        ok = ok && !r.error && index->division > 0;
+
+        for (uint32_t t = 0; ok && t < n_tracks && r.pos < r.size; t++) {
+            uint32_t chunk_type = read_u32be(&r);
+            uint32_t chunk_len = read_u32be(&r);
+            if (r.error || chunk_len > r.size - r.pos) {
+                ok = false;
+                break;
+            }
+            if (chunk_type == 0x4d54726b) { // MTrk
+                Reader track = { .data = r.data + r.pos, .size = chunk_len };
+                ok = parse_track(&track, (uint8_t) index->n_tracks, &notes, &tempos, &programs, &last_tick);
+                index->n_tracks++;
+            } else {
+                t--;        // unknown chunks don't count as tracks
+            }
+            r.pos += chunk_len;
+        }
+    }
+
+    ok = ok && build_tempo_map(index, &tempos);
+    if (ok && notes.size > 0) {
+        index->notes = malloc(notes.size * sizeof(*index->notes));
+        ok = index->notes != NULL;
+    }
+    if (ok) {
+        for (size_t i = 0; i < notes.size; i++) {
+            TickNote tn = notes.items[i];
+            index->notes[i] = (Note) {
+                .start = (float) note_index_tick_to_seconds(index, tn.start_tick),
+                .end = (float) note_index_tick_to_seconds(index, tn.end_tick),
+                .key = tn.key, .velocity = tn.velocity, .channel = tn.channel, .track = tn.track
+            };
+        }
+        index->n_notes = notes.size;
+        qsort(index->notes, index->n_notes, sizeof(*index->notes), compare_notes);
+        index->root_level = build_interval_tree(index->notes, index->n_notes);
+        index->total_ticks = last_tick;
+        index->duration = note_index_tick_to_seconds(index, last_tick);
+        ok = collect_program_uses(index, &programs);
+    }
+
+    free(notes.items);
+    free(tempos.items);
+    free(programs.items);
+    if (!ok) note_index_free(index);
+    return ok;
+}
+
+void note_index_free(NoteIndex *index) {
+    free(index->notes);
+    free(index->tempo_map);
+    free(index->programs);
+    memset(index, 0, sizeof(*index));
+}
+
+// Last tempo change at or before tick
+static const TempoChange *tempo_at_tick(const NoteIndex *index, int tick) {
+    size_t lo = 0;
+    size_t hi = index->n_tempo_changes;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->tempo_map[mid].tick <= tick) lo = mid;
+        else hi = mid;
+    }
+    return &index->tempo_map[lo];
+}
+
+static const TempoChange *tempo_at_seconds(const NoteIndex *index, double seconds) {
+    size_t lo = 0;
+    size_t hi = index->n_tempo_changes;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->tempo_map[mid].seconds <= seconds) lo = mid;
+        else hi = mid;
+    }
+    return &index->tempo_map[lo];
+}
+
+double note_index_tick_to_seconds(const NoteIndex *index, int tick) {
+    if (index->ticks_per_second > 0.0) return tick / index->ticks_per_second;
+    if (index->n_tempo_changes == 0) return 0.0;
+
+    const TempoChange *tempo = tempo_at_tick(index, tick);
+    return tempo->seconds + (double) (tick - tempo->tick) * tempo->usec_per_quarter / (1e6 * index->division);
+}
+
+int note_index_seconds_to_tick(const NoteIndex *index, double seconds) {
+    if (index->ticks_per_second > 0.0) return (int) (seconds * index->ticks_per_second);
+    if (index->n_tempo_changes == 0) return 0;
+
+    const TempoChange *tempo = tempo_at_seconds(index, seconds);
+    return tempo->tick + (int) ((seconds - tempo->seconds) * 1e6 * index->division / tempo->usec_per_quarter);
+}
+
+// Top down traversal of the implicit tree, cgranges' cr_overlap without the output array
+size_t note_index_query(const NoteIndex *index, float from, float to, NoteVisitor visit, void *user_data) {
+    struct { int k; size_t x; int w; } stack[QUERY_STACK_SIZE];
+    const Note *notes = index->notes;
+    size_t n = index->n_notes;
+    size_t visited = 0;
+    int t = 0;
+
+    if (n == 0) return 0;
+    stack[t].k = index->root_level;
+    stack[t].x = ((size_t) 1 << index->root_level) - 1;
+    stack[t++].w = 0;
+
+    while (t > 0) {
+        int k = stack[--t].k;
+        size_t x = stack[t].x;
+        int w = stack[t].w;
+
+        if (k <= QUERY_SCAN_LEVEL) {
+            size_t i0 = x >> k << k;
+            size_t i1 = i0 + ((size_t) 1 << (k + 1)) - 1;
+            if (i1 > n) i1 = n;
+            for (size_t i = i0; i < i1 && notes[i].start <= to; i++) {
+                if (notes[i].end >= from) {
+                    visit(&notes[i], user_data);
+                    visited++;
+                }
+            }
+        } else if (w == 0) {
+            size_t y = x - ((size_t) 1 << (k - 1));     // left child, may be past the end
+            stack[t].k = k;
+            stack[t].x = x;
+            stack[t++].w = 1;
+            if (y >= n || notes[y].max_end >= from) {
+                stack[t].k = k - 1;
+                stack[t].x = y;
+                stack[t++].w = 0;
+            }
+        } else if (x < n && notes[x].start <= to) {
+            if (notes[x].end >= from) {
+                visit(&notes[x], user_data);
+                visited++;
+            }
+            stack[t].k = k - 1;
+            stack[t].x = x + ((size_t) 1 << (k - 1));
+            stack[t++].w = 0;
+        }
+    }
+    return visited;
+}
@@ -0,0 +1,66 @@
+#ifndef NOTE_INDEX_H_
+#define NOTE_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One note of a parsed MIDI file, times in seconds from the start of the file
+typedef struct {
+    float start;
+    float end;
+    float max_end;          // largest end in this note's subtree of the implicit interval tree
+    uint8_t key;
+    uint8_t velocity;
+    uint8_t channel;
+    uint8_t track;
+} Note;
+
+typedef struct {
+    int tick;
+    double seconds;         // time of tick
+    int usec_per_quarter;
+} TempoChange;
+
+// A preset some notes are played with: the bank (CC 0) and program selected on their channel when they start
+typedef struct {
+    float first_start;      // seconds until the first of those notes
+    uint8_t channel;
+    uint8_t bank;
+    uint8_t program;
+} ProgramUse;
+
+// Every note of a MIDI file, sorted by start time, with an implicit interval tree over
+// the sorted array (same layout as cgranges) so overlap queries are O(log n + k).
+typedef struct {
+    Note *notes;
+    size_t n_notes;
+    int root_level;
+
+    TempoChange *tempo_map; // sorted by tick, always starts at tick 0
+    size_t n_tempo_changes;
+
+    ProgramUse *programs;   // every channel, bank and program that plays a note, in order of first_start
+    size_t n_programs;
+    double ticks_per_second;// only for SMPTE time division files, 0 otherwise
+
+    int division;
+    int n_tracks;
+    int total_ticks;
+    double duration;        // seconds until the last event of the file
+} NoteIndex;
+
+typedef void (*NoteVisitor)(const Note *note, void *user_data);
+
+bool note_index_load(NoteIndex *index, const char *file_path);
+// Same as note_index_load for a file that was read into memory already
+bool note_index_load_mem(NoteIndex *index, const uint8_t *data, size_t size);
+void note_index_free(NoteIndex *index);
+
+double note_index_tick_to_seconds(const NoteIndex *index, int tick);
+int note_index_seconds_to_tick(const NoteIndex *index, double seconds);
+
+// Calls visit for every note that sounds somewhere in [from, to], in start order. Returns the number of notes visited.
+size_t note_index_query(const NoteIndex *index, float from, float to, NoteVisitor visit, void *user_data);
+
+#endif // NOTE_INDEX_H_
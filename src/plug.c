@@ -3,6 +3,13 @@
 #include <stdint.h>
 #include <assert.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 #ifdef _WIN32
 #include "../WinDependencies/include/raylib.h"
@@ -11,11 +18,17 @@
 #else
 
 #include <raylib.h>
+#include <rlgl.h>
 #include <fluidsynth.h>
 
 #endif
 
 #include "plug.h"
+#include "video_writer.h"
+#include "note_index.h"
+#include "profiler.h"
+#include "stress.h"
+#include "latency.h"
 
 #define N_KEYS 88
 #define N_WHITE_KEYS 52
@@ -26,40 +39,69 @@
 #define WHITE_BLACK_HEIGHT_RATIO 0.65f
 #define WHITE_BLACK_WIDTH_RATIO 0.6f
 
-#define SCROLL_RECT_CAP 10
+// Hard limit of live scroll rects per key, must be a power of two.
+// When a key runs out of slots its oldest rect is retired early.
+#ifndef SCROLL_RECT_CAP
+#define SCROLL_RECT_CAP 128
+#endif
+static_assert((SCROLL_RECT_CAP & (SCROLL_RECT_CAP - 1)) == 0, "SCROLL_RECT_CAP must be a power of two");
 
 #define SCROLL_SPEED 200
 #define KEY_SCROLL_RECT_OFFSET 5
 
 #define FONT_SIZE 64
 
+#define SCROLL_RECT_ROUNDNESS 0.5f
+#define SCROLL_RECT_SEGMENTS 5
+#define SCROLL_RECT_LINE_THICK 2
+// vertices DrawRectangleRoundedLines emits in quad mode: one quad per corner segment plus the four sides
+#define SCROLL_RECT_OUTLINE_VERTICES ((4 * SCROLL_RECT_SEGMENTS + 4) * 4)
+
 #define GAIN_MAX 10.f
 
-float padding = 1.0f;
+#define NOTE_EVENT_RING_CAP 4096 // must be a power of two
+#define HELD_NOTES_CAP 256       // notes a seek starts again at its target, more are left silent
 
-float whiteKey_width;
-float whiteKey_height;
+#define OFFLINE_PERIOD_MIN 64    // limits of fluidsynth's audio.period-size
+#define OFFLINE_PERIOD_MAX 8192
+#define EXPORT_TAIL_MAX 5.0      // seconds an export goes on after the last event while voices still sound
 
-float blackKey_width;
-float blackKey_height;
+#define AUDIO_HEALTH_INTERVAL 1.0 // seconds between refreshes of the audio overlay and log
 
-float bottom_offset = 0.f;
-float left_offset = 0.f;
+#define BENCHMARK_VOICE_BUCKET 16 // blocks are grouped by active voices in steps of this many
+#define BENCHMARK_BUCKETS 64
+#define BENCHMARK_MIN_BLOCKS 32    // a bucket needs this many blocks in both runs to be compared
+
+#define MAX_POINTERS 10           // mouse or touch points that can each hold a key
+
+#define INPUT_FRAME_SAMPLES 64    // MIDI input events per frame whose time to the screen is measured
 
-Image perlin_image;
-Texture perlin_texture;
+#define SIM_HZ 240                // fixed rate of the simulation (key state, rect motion, noise animation)
+#define SIM_DT (1.f / SIM_HZ)
+#define SIM_MAX_TICKS 60          // a quarter second, longer stalls are skipped instead of caught up
 
-int perlin_offset_x;
-int perlin_offset_y;
+#define SOUNDFONT_READ_CHUNK (4 << 20) // sample data is read in pieces of this size, so the progress keeps moving
+#define SOUNDFONT_HASH_BYTES (1 << 20)  // hashed from the start and the end of a file, with its size
 
-float perlin_dt = 0.f;
+#define AV_OFFSET_STEP 0.005        // what [ and ] change the A/V offset by
+#define AV_OFFSET_MAX 1.0
 
+#define IDLE_FPS 4                // redraws per second while nothing moves, keeps the overlays current
+#define IDLE_POLL_INTERVAL 0.01   // seconds between input polls while no frame is drawn
+
+#define STRESS_SLOW_FRAME 1.5f   // frames longer than this many target frames count as dropped
+#define STRESS_TARGET_FPS 60     // what main.c asks raylib for
+
+float padding = 1.0f;
+
+float bottom_offset = 0.f;
+float left_offset = 0.f;
+
+// the noise itself is generated in the key shaders, animated by Simulation.noise
 int wk_perlin_threshold_loc;
 int bk_perlin_threshold_loc;
-float wk_perlin_threshold = 0.6f;
-float bk_perlin_threshold = 0.4f;
-float wk_perlin_threshold_mult = 0.2f;
-float bk_perlin_threshold_mult = -0.2f;
+int wk_perlin_time_loc;
+int bk_perlin_time_loc;
 
 typedef struct {
     const char *file_path;
@@ -88,38 +130,300 @@ typedef struct {
     VolumeSlider timeline;
 } UserInterface;
 
+// A played note on the simulation clock (Simulation.now), where it is on screen follows from the time drawn
 typedef struct {
-    Rectangle rect;
+    double start;
+    double end;                 // only once finished, until then the rect keeps growing out of its key
     bool finished;
 } ScrollRect;
 
+typedef struct {
+    float wk_threshold;
+    float bk_threshold;
+    float wk_threshold_mult;
+    float bk_threshold_mult;
+    float time;                 // wrapped to [0, 2 PI), the shaders only use sin/cos of it
+} NoiseAnimation;
+
+// Advances in fixed SIM_DT ticks, from plug_update or from its own thread (PlugOptions.sim_thread).
+// Frames draw the state interpolated between the last two ticks.
+typedef struct {
+    float accumulator;          // frame time not simulated yet, only without the thread
+    float alpha;                // where the frame lies between the previous (0) and the last tick (1)
+    double last_tick;           // GetTime() of the last tick, only with the thread
+    unsigned long long ticks;
+    double now;                 // seconds on the simulation clock the frame shows, counted from ticks so it never drifts
+    NoiseAnimation noise;
+    NoiseAnimation prev_noise;
+
+    // with the thread, everything the ticks touch (keys, scroll rects, noise, the clock) is only accessed under lock
+    bool threaded;
+    atomic_bool running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+} Simulation;
+
+// FIFO of the rects of one key, backed by a slice of Plug.scroll_rect_pool.
+// Rects are appended at the back and retired from the front in creation order.
 typedef struct {
     ScrollRect *scrollRects;
+    size_t head;
     size_t size;
-    size_t capacity;
+    size_t dropped;             // rects retired early because the key ran out of slots
 } ScrollRects;
 
+// What render_keys and update_keys touch every frame, as struct of arrays indexed by key.
+// The geometry is only written by layout_keyboard, the color tables once by init_keys.
+typedef struct {
+    bool pressed[N_KEYS];
+    bool white[N_KEYS];
+    float x[N_KEYS];
+    float width[N_KEYS];
+    float height[N_KEYS];
+    uint8_t white_keys[N_WHITE_KEYS];   // key index of the n-th white key
+    uint8_t black_keys[N_BLACK_KEYS];
+
+    float top;                          // y of every key
+    float white_width;
+    float white_height;
+    float black_width;
+    float black_height;
+    int screen_width;                   // window size the geometry was computed for
+    int screen_height;
+} Keyboard;
+
+typedef enum {
+    NOTE_EVENT_OFF,
+    NOTE_EVENT_ON,
+} NoteEventKind;
+
+typedef struct {
+    double time;                // GetTime() at the moment the player fired the event
+    double due;                 // when it is heard, in the same clock, the render loop holds it back until then
+    int tick;                   // last player tick published before the event
+    uint8_t kind;
+    uint8_t key;
+    uint8_t velocity;
+    uint8_t channel;
+} NoteEvent;
+
+// Single producer (fluidsynth player/audio thread), single consumer (render loop).
+// head is only stored by the producer, tail only by the consumer.
+typedef struct {
+    NoteEvent events[NOTE_EVENT_RING_CAP];
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_size_t overflows;
+} NoteEventRing;
+
+typedef struct {
+    uint8_t channel;
+    uint8_t key;
+    uint8_t velocity;
+} HeldNote;
+
+// Written by the player thread, read once per frame by the render loop
+typedef struct {
+    atomic_int tick;            // -1 until the player reported the first tick of the current piece
+    atomic_int seek_tick;       // set by the render loop, taken by the player thread once the seek is applied, -1 otherwise
+    atomic_int seek_from;       // where the player was when seek_tick was set
+    HeldNote held_notes[HELD_NOTES_CAP]; // sounding at seek_tick, only written while no seek is armed (disarm_seek)
+    int n_held_notes;
+    atomic_bool replaying;      // the player thread is starting held_notes
+    atomic_int end_tick;        // last tick of the current piece, 0 when it is not known
+    _Atomic(fluid_player_t *) next_player; // started by the player thread at end_tick, which takes it out
+} PlaybackShared;
+
+typedef struct {
+    int tick;
+    int status;
+} PlaybackSnapshot;
+
+// Buffering of the audio driver, picked with --latency. Some drivers (jack, pulseaudio) decide on their own buffering.
+typedef struct {
+    const char *name;
+    int period_size;
+    int periods;
+    double sample_rate;
+} LatencyProfile;
+
+static const LatencyProfile latency_profiles[] = {
+    {"ultra-low", 64, 2, 48000.0},      // 2.7 ms, live playing on a tuned machine
+    {"balanced", 128, 4, 48000.0},      // 10.7 ms
+    {"safe", 512, 8, 44100.0},          // 92.9 ms, unattended machines that must never drop out
+};
+
+// Written by the audio driver thread in audio_callback, read once per frame by the render loop
+typedef struct {
+    atomic_llong blocks;
+    atomic_llong late_blocks;       // took longer to render than they last
+    atomic_llong xruns;             // started so long after the previous block that the device buffer ran dry
+    atomic_int render_usec_max;     // slowest block since the render loop last took it
+    atomic_int period_usec;         // length of the last block
+    atomic_llong pending_input_usec;// arrival of the oldest MIDI input not rendered yet, 0 when there is none
+    atomic_int av_offset_usec;      // from rendering a block until it is heard, set by the render loop
+    atomic_llong audible_usec;      // GetTime() at which the block being rendered starts to play, 0 before the first
+    double last_block_start;        // only touched by the audio thread
+    long long samples;              // the sample clock: rendered so far, only touched by the audio thread
+    double clock_offset;            // GetTime() - samples / sample_rate, smoothed, only touched by the audio thread
+    double sample_rate;             // set before the driver starts
+    double xrun_gap;                // seconds of audio the device buffers, set before the driver starts
+} AudioHealthShared;
+
+// What the overlay shows, refreshed every AUDIO_HEALTH_INTERVAL
+typedef struct {
+    double interval_start;
+    long long blocks;               // totals at interval_start
+    long long late_blocks;
+    long long xruns;
+    long long interval_late_blocks;
+    long long interval_xruns;
+    float render_ms_max;
+    float period_ms;
+    double cpu_load;
+    int voices;
+} AudioHealth;
+
+// Grown on demand and reused every frame
+typedef struct {
+    Rectangle *items;
+    size_t size;
+    size_t capacity;
+} Rects;
+
+// Reset at the start of every frame
+typedef struct {
+    size_t draw_calls;          // batches submitted by render_scroll_rects
+    size_t batch_flushes;       // submissions forced because the rlgl batch buffer ran full
+    size_t live_rects;
+} RenderStats;
+
+// The synth advanced by rendering instead of by an audio device, used by both exports.
+// The player follows the sample timer, so fluid_synth_get_ticks() is the playback clock.
+typedef struct {
+    bool active;
+    fluid_file_renderer_t *renderer;    // NULL when the audio is only rendered to advance the player
+    float *scratch;                     // one period per channel, when there is no renderer
+    FILE *events_file;
+    int sample_rate;
+    int period_size;
+    long long samples_rendered;
+    long long piece_end;                // samples_rendered when the player was done, -1 before
+    double start_time;                  // wall clock, for the real time factor
+} OfflineAudio;
+
+// Offline rendering of a midi file into a video, see PlugOptions.video_path
+typedef struct {
+    bool active;
+    bool finished;
+    RenderTexture2D target;
+    VideoWriter *writer;
+    size_t frames;
+} VideoExport;
+
+// Generated notes instead of a midi file, see PlugOptions.stress_spec
+typedef struct {
+    bool active;
+    bool finished;
+    StressGenerator generator;
+    fluid_midi_event_t *event;          // reused for every generated note
+    FILE *results;
+    double start_time;
+    size_t frames;
+    size_t slow_frames;
+    double first_slow_nps;              // notes per second when the first frame was dropped, 0 if none was
+} StressTest;
+
+// A soundfont on the synth's stack. Dropping a file with the same contents again brings it back to the top
+// instead of loading it twice.
+typedef struct {
+    char *file_path;
+    uint64_t hash;                  // hash_soundfont_file
+    long long file_size;            // what the memory budget counts
+    int id;                         // fluidsynth's, a font brought back to the top gets a new one
+    int refs;                       // channels whose preset it provides, plus one for the newest font
+    double last_used;               // GetTime() when it was last dropped or provided a preset
+} SoundFontEntry;
+
+typedef struct {
+    SoundFontEntry *items;
+    size_t size;
+    size_t capacity;
+} SoundFonts;
+
+// Of a file loaded on its own thread, the render loop takes the result once it is LOAD_DONE
+typedef enum {
+    LOAD_IDLE,
+    LOAD_RUNNING,
+    LOAD_DONE,
+} LoadState;
+
+// A soundfont loaded on its own thread by a staging synth, so the synth the audio runs on is not locked
+// for the whole load but only while it takes over the finished font. The staging synth owns the loader,
+// whose file callbacks the fonts keep using, so it lives until plug_clean.
+typedef struct {
+    atomic_int state;
+    atomic_llong bytes_read;
+    long long file_size;
+    char *file_path;
+    fluid_sfont_t *sfont;
+    pthread_t thread;
+
+    // the file is hashed first and not loaded at all when a font with that hash is on the stack already
+    uint64_t *known_hashes;
+    size_t n_known_hashes;
+    uint64_t hash;
+    bool duplicate;
+
+    fluid_settings_t *settings;
+    fluid_synth_t *synth;
+    fluid_sfloader_t *loader;
+} SoundFontLoad;
+
+// A midi file read and indexed on its own thread while the current piece plays on,
+// finish_midi_load swaps the player over once it is ready
+typedef struct {
+    atomic_int state;
+    char *file_path;
+    uint8_t *data;                  // the whole file, NULL when it could not be read
+    size_t size;
+    NoteIndex index;
+    bool indexed;
+    bool prefetch;                  // the piece after the current one of the playlist, see prefetch_next_piece
+    bool threaded;                  // false when no thread could be started and it was loaded right away
+    pthread_t thread;
+} MidiLoad;
+
+// Midi files played one after another, from a drop of several files or a playlist file
+typedef struct {
+    char **items;
+    size_t size;
+    size_t capacity;
+    size_t current;
+} Playlist;
+
+// A mouse button or finger holding a key down
 typedef struct {
-    size_t index;
-    size_t color_index;
-    size_t key_oct;
-    bool pressed;
-    bool white;
-    Rectangle key_rect;
-    ScrollRects scroll_rects;
-} Key;
+    int id;                             // raylib touch point id, -1 for the mouse
+    int key;                            // -1 while it is on no key
+} Pointer;
 
 typedef struct {
     // Key stuff
-    Key keys[N_KEYS];
-    Key *white_keys[N_WHITE_KEYS];
-    Key *black_keys[N_BLACK_KEYS];
-    Key *last_pressed_key;
+    Keyboard keyboard;
+    ScrollRects scroll_rects[N_KEYS];
+    Pointer pointers[MAX_POINTERS];
+    size_t n_pointers;
 
 
     Font font;
     MidiPiece current_piece;
     bool new_piece_loaded;
+    MidiLoad midi_load;
+    Playlist playlist;
+    fluid_player_t *next_player;    // ready to go on with the next entry of the playlist, NULL otherwise
+    NoteIndex next_index;
+    bool next_indexed;
 
     //fluidsynth
     fluid_settings_t *fs_settings;
@@ -127,238 +431,1987 @@ typedef struct {
     fluid_audio_driver_t *fs_audio_driver;
     fluid_player_t *fs_player;
     int sound_font_id;
+    SoundFontLoad sfont_load;
+    SoundFonts soundfonts;
+    long long resident_before_fonts;// resident memory before the first soundfont, 0 until then
 
     Shader wk_shader;
     Shader bk_shader;
 
     UserInterface ui;
+
+    ScrollRect *scroll_rect_pool;   // N_KEYS * SCROLL_RECT_CAP, allocated once in init_keys
+    RenderStats render_stats;
+    Rects visible_white_rects;      // what render_scroll_rects draws this frame
+    Rects visible_black_rects;
+
+    NoteIndex note_index;           // every note of the current piece, parsed when it is loaded
+    bool falling_notes;             // show upcoming notes falling onto the keys instead of the played ones rising
+    int last_seek_tick;
+
+    Simulation sim;
+
+    Profiler profiler;
+    bool show_profiler;             // per phase frame time overlay, toggled with F3
+    double last_frame;              // GetTime() of the last frame that was drawn
+
+    PlugOptions options;
+    OfflineAudio offline_audio;
+    VideoExport video_export;
+    StressTest stress;
+
+    // player thread -> render loop
+    NoteEventRing note_events;
+    PlaybackShared playback_shared;
+    PlaybackSnapshot playback;
+    size_t reported_overflows;
+
+    // audio driver thread -> render loop
+    AudioHealthShared audio_shared;
+    AudioHealth audio_health;
+    double av_offset;               // seconds the visuals wait for the audio, negative until the driver picked one
+
+    // MIDI input: the midi driver thread (or the replay player) -> render loop
+    fluid_midi_driver_t *fs_midi_driver;
+    fluid_player_t *replay_player;
+    NoteEventRing midi_input_events;
+    size_t reported_input_overflows;
+    LatencyHistogram input_to_audio;    // arrival until the audio block playing it is rendered
+    LatencyHistogram input_to_frame;    // arrival until the frame showing it is swapped to the screen
+    double frame_inputs[INPUT_FRAME_SAMPLES];
+    size_t n_frame_inputs;
 } Plug;
 
 static Plug *p = NULL;
 
 
-void init_sr_array(ScrollRects *arr, size_t initialCapacity) {
-    arr->scrollRects = malloc(initialCapacity * sizeof(ScrollRect));
-    arr->size = 0;
-    arr->capacity = initialCapacity;
+void init_sr_array(ScrollRects *arr, ScrollRect *storage) {
+    arr->scrollRects = storage;
+    arr->head = 0;
+    arr->size = 0;
+    arr->dropped = 0;
+}
+
+ScrollRect *scroll_rect_at(ScrollRects *arr, size_t index) {
+    return &arr->scrollRects[(arr->head + index) & (SCROLL_RECT_CAP - 1)];
+}
+
+ScrollRect *last_scroll_rect(ScrollRects *arr) {
+    return arr->size > 0 ? scroll_rect_at(arr, arr->size - 1) : NULL;
+}
+
+// Removes the oldest rect
+void retire_scroll_rect(ScrollRects *arr) {
+    if (arr->size == 0) {
+        TraceLog(LOG_WARNING, "Attempted to retire a scroll rect from an empty array");
+        return;
+    }
+    arr->head = (arr->head + 1) & (SCROLL_RECT_CAP - 1);
+    arr->size--;
+}
+
+void append_scroll_rect(ScrollRects *arr, ScrollRect sr) {
+    if (arr->size == SCROLL_RECT_CAP) {
+        retire_scroll_rect(arr);
+        arr->dropped++;
+    }
+    *scroll_rect_at(arr, arr->size) = sr;
+    arr->size++;
+}
+
+bool note_ring_push(NoteEventRing *ring, NoteEvent ev) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == NOTE_EVENT_RING_CAP) {
+        atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+        return false;
+    }
+    ring->events[head & (NOTE_EVENT_RING_CAP - 1)] = ev;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool note_ring_pop(NoteEventRing *ring, NoteEvent *ev) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) return false;
+    *ev = ring->events[tail & (NOTE_EVENT_RING_CAP - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// The oldest event without taking it, only call from the consumer side
+bool note_ring_peek(NoteEventRing *ring, NoteEvent *ev) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) return false;
+    *ev = ring->events[tail & (NOTE_EVENT_RING_CAP - 1)];
+    return true;
+}
+
+bool note_ring_empty(NoteEventRing *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+// Drops everything that is still queued, only call from the consumer side
+void note_ring_clear(NoteEventRing *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+}
+
+// Starting at C
+static const bool white_in_octave[KEYS_IN_OCTAVE] = {
+    true, false, true, false, true, true, false, true, false, true, false, true,
+};
+
+// Wall clock for measuring real time factors, also works without a window
+double wall_time(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// Time stamps for note events: GetTime() live, rendered samples when offline.
+// Offline events are stamped with the start of the period that rendered them,
+// which during a video export is the start of the frame that shows them.
+double playback_clock(void) {
+    if (p->offline_audio.active) {
+        return (double) p->offline_audio.samples_rendered / (double) p->offline_audio.sample_rate;
+    }
+    return GetTime();
+}
+
+// When a note the synth gets right now is heard. Offline, audio and video share the sample clock. Live, the
+// block being rendered is heard once the device buffers played out, on the audio thread its start is known
+// from the sample clock, other threads get their notes into the next block.
+double audible_time(bool rendering) {
+    if (p->offline_audio.active) return playback_clock();
+    long long audible = atomic_load_explicit(&p->audio_shared.audible_usec, memory_order_relaxed);
+    if (rendering && audible != 0) return (double) audible * 1e-6;
+    return GetTime() + atomic_load_explicit(&p->audio_shared.av_offset_usec, memory_order_relaxed) * 1e-6;
+}
+
+// Events in the same clock as the rendered audio, for muxing audio and video afterwards
+void log_note_event(const NoteEvent *ev) {
+    OfflineAudio *oa = &p->offline_audio;
+    // only keys of the keyboard, so both exports list the same events
+    if (oa->events_file == NULL || ev->key < 21 || ev->key >= 21 + N_KEYS) return;
+
+    fprintf(oa->events_file, "%lld,%.6f,%s,%d,%d,%d\n", llround(ev->time * oa->sample_rate), ev->time,
+            ev->kind == NOTE_EVENT_ON ? "on" : "off", ev->key, ev->velocity, ev->channel);
+}
+
+// Duration of the frame being simulated: fixed while exporting, wall clock otherwise.
+// After skipped idle frames raylib's frame time spans the whole pause, which must not move anything.
+float frame_time(void) {
+    if (p->video_export.active) return 1.f / (float) p->options.fps;
+    return fminf(GetFrameTime(), 1.f / IDLE_FPS);
+}
+
+void lock_simulation(void) {
+    if (p->sim.threaded) pthread_mutex_lock(&p->sim.lock);
+}
+
+void unlock_simulation(void) {
+    if (p->sim.threaded) pthread_mutex_unlock(&p->sim.lock);
+}
+
+// Recomputes the geometry of the keys, but only when the window size changed since the last time
+void layout_keyboard(void) {
+    Keyboard *kb = &p->keyboard;
+    int screen_width = GetScreenWidth();
+    int screen_height = GetScreenHeight();
+    if (screen_width == kb->screen_width && screen_height == kb->screen_height) return;
+    kb->screen_width = screen_width;
+    kb->screen_height = screen_height;
+
+    kb->white_width = (((float) screen_width - left_offset) - (padding * (N_WHITE_KEYS - 1))) / N_WHITE_KEYS;
+    kb->white_height = kb->white_width * WHITE_KEY_WH_RATIO;
+    kb->black_width = kb->white_width * WHITE_BLACK_WIDTH_RATIO;
+    kb->black_height = kb->white_height * WHITE_BLACK_HEIGHT_RATIO;
+    kb->top = (float) screen_height - kb->white_height - bottom_offset;
+
+    float stride = kb->white_width + padding;
+    for (size_t n = 0; n < N_WHITE_KEYS; n++) {
+        size_t i = kb->white_keys[n];
+        kb->x[i] = (float) n * stride + left_offset;
+        kb->width[i] = kb->white_width;
+        kb->height[i] = kb->white_height;
+    }
+    // a black key sits on the gap after the white key below it, which is never the lowest key
+    for (size_t n = 0; n < N_BLACK_KEYS; n++) {
+        size_t i = kb->black_keys[n];
+        kb->x[i] = kb->x[i - 1] + stride - kb->black_width / 2.f;
+        kb->width[i] = kb->black_width;
+        kb->height[i] = kb->black_height;
+    }
+}
+
+// Every note reaches the synth through here: queued for the render loop, then played.
+// Runs on the fluidsynth player or midi driver thread: must not touch p->keys or allocate, only queue the event.
+// Each ring has exactly one producer thread.
+int handle_midi_event(NoteEventRing *ring, fluid_midi_event_t *event, double due) {
+    NoteEvent ev = {0};
+    int status = fluid_midi_event_get_type(event);
+    int key = fluid_midi_event_get_key(event);
+    int velocity = fluid_midi_event_get_velocity(event);
+
+    if (status == 0x80 || status == 0x90) {
+        ev.time = playback_clock();
+        ev.due = due;
+        ev.tick = atomic_load_explicit(&p->playback_shared.tick, memory_order_relaxed);
+        ev.kind = (status == 0x90 && velocity > 0) ? NOTE_EVENT_ON : NOTE_EVENT_OFF;
+        ev.key = key;
+        ev.velocity = velocity;
+        ev.channel = fluid_midi_event_get_channel(event);
+        note_ring_push(ring, ev);
+    }
+
+    return fluid_synth_handle_midi_event(p->fs_synth, event);
+}
+
+int player_midi_callback(void *data, fluid_midi_event_t *event) {
+    (void) data;
+    // the player runs on the sample clock, inside the audio block that plays the event
+    return handle_midi_event(&p->note_events, event, audible_time(true));
+}
+
+// Runs on the midi driver thread, or the replay player's timer thread standing in for a device
+int midi_input_callback(void *data, fluid_midi_event_t *event) {
+    (void) data;
+    double arrival = GetTime();
+    int result = handle_midi_event(&p->midi_input_events, event, audible_time(false));
+
+    // only once the synth has the event can the next audio block play it
+    long long none = 0;
+    atomic_compare_exchange_strong_explicit(&p->audio_shared.pending_input_usec, &none, (long long) (arrival * 1e6),
+                                            memory_order_relaxed, memory_order_relaxed);
+    return result;
+}
+
+int player_tick_callback(void *data, int tick) {
+    (void) data;
+    // The player silences everything when it applies a seek and skips the note ons before the target,
+    // so notes that are held across the target are started again right here on the player thread. The
+    // callback of the block that applies the seek still reports the old position and the next one the
+    // target plus that block, so the seek has landed once the tick is nearer the target than where it was.
+    // The notes come from the list seek_to_tick made, the note index belongs to the render loop.
+    PlaybackShared *shared = &p->playback_shared;
+    if (atomic_load_explicit(&shared->seek_tick, memory_order_relaxed) >= 0) {
+        // seq_cst against disarm_seek: either it sees replaying or this sees the seek taken back
+        atomic_store(&shared->replaying, true);
+        int seek_tick = atomic_load(&shared->seek_tick);
+        int seek_from = atomic_load_explicit(&shared->seek_from, memory_order_relaxed);
+        bool landed = seek_tick >= 0 && abs(tick - seek_tick) <= abs(tick - seek_from);
+        if (landed && atomic_compare_exchange_strong(&shared->seek_tick, &seek_tick, -1)) {
+            for (int i = 0; i < shared->n_held_notes; i++) {
+                const HeldNote *note = &shared->held_notes[i];
+                fluid_synth_noteon(p->fs_synth, note->channel, note->key, note->velocity);
+            }
+        }
+        atomic_store(&shared->replaying, false);
+    }
+    atomic_store_explicit(&p->playback_shared.tick, tick, memory_order_release);
+
+    // the next piece of the playlist starts in the same audio block the current one ends in
+    int end_tick = atomic_load_explicit(&p->playback_shared.end_tick, memory_order_relaxed);
+    if (end_tick > 0 && tick >= end_tick) {
+        fluid_player_t *next = atomic_exchange_explicit(&p->playback_shared.next_player, NULL, memory_order_acq_rel);
+        if (next != NULL) fluid_player_play(next);
+    }
+    return FLUID_OK;
+}
+
+// Takes back a seek the player thread has not applied yet and waits until it is not starting held notes
+void disarm_seek(void) {
+    atomic_store(&p->playback_shared.seek_tick, -1);
+    while (atomic_load(&p->playback_shared.replaying)) {}
+}
+
+// Stops the newest rect of a key from growing at time, on the simulation clock
+void finish_scroll_rect(ScrollRects *rects, double time) {
+    ScrollRect *last = last_scroll_rect(rects);
+    if (last == NULL || last->finished) return;
+    last->end = time;
+    last->finished = true;
+}
+
+void press_key(size_t key_index, double time) {
+    Keyboard *kb = &p->keyboard;
+    ScrollRects *rects = &p->scroll_rects[key_index];
+    ScrollRect sr = {0};
+    // an unfinished rect at the front would block retiring everything behind it
+    finish_scroll_rect(rects, time);
+    kb->pressed[key_index] = true;
+    sr.start = time;
+    sr.finished = false;
+    append_scroll_rect(rects, sr);
+}
+
+void release_key(size_t key_index, double time) {
+    p->keyboard.pressed[key_index] = false;
+    finish_scroll_rect(&p->scroll_rects[key_index], time);
+}
+
+// late: how long ago the event was heard, the rect starts that much before the frame so it lines up
+// with the ones of earlier frames
+bool apply_note_event(const NoteEvent *ev, double late) {
+    if (ev->key < 21 || ev->key >= 21 + N_KEYS) return false;
+    log_note_event(ev);
+    size_t key_index = ev->key - 21;
+    double time = p->sim.now - fmin(fmax(late, 0.0), 1.0 / IDLE_FPS);
+    if (ev->kind == NOTE_EVENT_ON) {
+        press_key(key_index, time);
+    } else {
+        release_key(key_index, time);
+    }
+    return true;
+}
+
+void report_ring_overflows(NoteEventRing *ring, size_t *reported, const char *name) {
+    size_t overflows = atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+    if (overflows != *reported) {
+        TraceLog(LOG_WARNING, "MIDI: %s ring overflowed, %zu events dropped so far", name, overflows);
+        *reported = overflows;
+    }
+}
+
+// Takes the oldest event of ring once it is heard, events are queued in the order they are heard
+bool pop_due_note_event(NoteEventRing *ring, double now, NoteEvent *ev) {
+    if (!note_ring_peek(ring, ev) || ev->due > now) return false;
+    return note_ring_pop(ring, ev);
+}
+
+// Applies the note events queued by the player and the MIDI input that are heard by now
+void drain_note_events(void) {
+    NoteEvent ev;
+    double now = playback_clock();
+    // an export steps both clocks together and has no lateness to make up
+    bool offline = p->offline_audio.active;
+
+    while (pop_due_note_event(&p->note_events, now, &ev)) apply_note_event(&ev, offline ? 0.0 : now - ev.due);
+    report_ring_overflows(&p->note_events, &p->reported_overflows, "note event");
+
+    p->n_frame_inputs = 0;
+    while (pop_due_note_event(&p->midi_input_events, now, &ev)) {
+        if (apply_note_event(&ev, offline ? 0.0 : now - ev.due) && ev.kind == NOTE_EVENT_ON &&
+            p->n_frame_inputs < INPUT_FRAME_SAMPLES) {
+            p->frame_inputs[p->n_frame_inputs++] = ev.time;
+        }
+    }
+    report_ring_overflows(&p->midi_input_events, &p->reported_input_overflows, "MIDI input");
+}
+
+// Right after the swap of the frame that drew the note ons taken in drain_note_events
+void record_input_frame_latency(void) {
+    double now = GetTime();
+    for (size_t i = 0; i < p->n_frame_inputs; i++) latency_record(&p->input_to_frame, now - p->frame_inputs[i]);
+    p->n_frame_inputs = 0;
+}
+
+// Reads the player state once per frame so the UI does not have to call into the player
+void take_playback_snapshot(void) {
+    p->playback.tick = atomic_load_explicit(&p->playback_shared.tick, memory_order_acquire);
+    p->playback.status = p->fs_player != NULL ? fluid_player_get_status(p->fs_player) : FLUID_PLAYER_READY;
+
+    if (!p->new_piece_loaded && p->fs_player != NULL && p->playback.tick >= 0) {
+        // the note index has the length already, unless the file could not be indexed
+        if (p->current_piece.total_ticks <= 0) {
+            p->current_piece.total_ticks = fluid_player_get_total_ticks(p->fs_player);
+            p->current_piece.duration = (float) (p->current_piece.total_ticks /
+                                                 fluid_player_get_division(p->fs_player)) /
+                                        (float) fluid_player_get_bpm(p->fs_player) * 60.f;
+        }
+        p->current_piece.progress = 0.f;
+        p->new_piece_loaded = true;
+    }
+}
+
+// Takes what the audio thread measured since the last interval, logs it when blocks were late or lost
+void update_audio_health(void) {
+    AudioHealthShared *shared = &p->audio_shared;
+    AudioHealth *health = &p->audio_health;
+    double now = GetTime();
+    if (p->fs_audio_driver == NULL || now - health->interval_start < AUDIO_HEALTH_INTERVAL) return;
+
+    long long blocks = atomic_load_explicit(&shared->blocks, memory_order_relaxed);
+    long long late_blocks = atomic_load_explicit(&shared->late_blocks, memory_order_relaxed);
+    long long xruns = atomic_load_explicit(&shared->xruns, memory_order_relaxed);
+    health->interval_late_blocks = late_blocks - health->late_blocks;
+    health->interval_xruns = xruns - health->xruns;
+    health->render_ms_max = atomic_exchange_explicit(&shared->render_usec_max, 0, memory_order_relaxed) / 1000.f;
+    health->period_ms = atomic_load_explicit(&shared->period_usec, memory_order_relaxed) / 1000.f;
+    health->cpu_load = fluid_synth_get_cpu_load(p->fs_synth);
+    health->voices = fluid_synth_get_active_voice_count(p->fs_synth);
+
+    int level = health->interval_late_blocks > 0 || health->interval_xruns > 0 ? LOG_WARNING : LOG_DEBUG;
+    TraceLog(level, "AUDIO: %lld blocks, %lld late, %lld xruns, slowest %.2f of %.2f ms, cpu %.0f%%, %d voices",
+             blocks - health->blocks, health->interval_late_blocks, health->interval_xruns, health->render_ms_max,
+             health->period_ms, health->cpu_load, health->voices);
+
+    health->blocks = blocks;
+    health->late_blocks = late_blocks;
+    health->xruns = xruns;
+    health->interval_start = now;
+}
+
+void init_ui(void) {
+    int screen_width = GetScreenWidth();
+    int screen_height = GetScreenHeight();
+    float slider_padding;
+    float slider_height;
+
+    p->ui.timeline.bounds = CLITERAL(Rectangle)
+    {
+        .x = 0,
+        .y = screen_height * 0.9f,
+        .width = screen_width * 0.8f,
+        .height = screen_height * 0.1f
+    };
+
+    slider_padding = p->ui.timeline.bounds.width * 0.1f / 2.f;
+    slider_height = p->ui.timeline.bounds.height * 0.1f;
+    p->ui.timeline.slider.bounds = CLITERAL(Rectangle)
+    {
+        .x = p->ui.timeline.bounds.x + slider_padding,
+        .y = p->ui.timeline.bounds.y + (p->ui.timeline.bounds.height / 2.f) - (slider_height / 2.f),
+        .width = p->ui.timeline.bounds.width - 2.f * slider_padding,
+        .height = slider_height
+    };
+
+    p->ui.volume_slider.bounds = CLITERAL(Rectangle)
+    {
+        .x = p->ui.timeline.bounds.width,
+        .y = p->ui.timeline.bounds.y,
+        .width = screen_width - p->ui.timeline.bounds.width,
+        .height = p->ui.timeline.bounds.height
+    };
+
+    slider_padding = p->ui.volume_slider.bounds.width * 0.1f / 2.f;
+    slider_height = p->ui.volume_slider.bounds.height * 0.1f;
+    p->ui.volume_slider.slider.bounds = CLITERAL(Rectangle)
+    {
+        .x = p->ui.volume_slider.bounds.x + slider_padding,
+        .y = p->ui.volume_slider.bounds.y + (p->ui.volume_slider.bounds.height / 2.f) - (slider_height / 2.f),
+        .width = p->ui.volume_slider.bounds.width - 2.f * slider_padding,
+        .height = slider_height
+    };
+    bottom_offset = screen_height - p->ui.timeline.bounds.y;
+    // left_offset = 100.f;
+}
+
+
+void init_keys(void) {
+    Keyboard *kb = &p->keyboard;
+
+    if (p->scroll_rect_pool == NULL) {
+        p->scroll_rect_pool = malloc(N_KEYS * SCROLL_RECT_CAP * sizeof(ScrollRect));
+        assert(p->scroll_rect_pool != NULL && "Buy more RAM lol");
+    }
+
+    size_t black_index = 0;
+    size_t white_index = 0;
+    for (size_t i = 0; i < N_KEYS; i++) {
+        // the piano starts at A0
+        kb->pressed[i] = false;
+        kb->white[i] = white_in_octave[(i + 9) % KEYS_IN_OCTAVE];
+        if (kb->white[i]) {
+            kb->white_keys[white_index++] = i;
+        } else {
+            kb->black_keys[black_index++] = i;
+        }
+        init_sr_array(&p->scroll_rects[i], &p->scroll_rect_pool[i * SCROLL_RECT_CAP]);
+    }
+
+    // force a layout for the current window
+    kb->screen_width = 0;
+    kb->screen_height = 0;
+    layout_keyboard();
+}
+
+// Runs on the audio driver thread for every block the device asks for, so the block can be timed.
+// GetTime() is glfwGetTime(), which may be called from any thread.
+int audio_callback(void *data, int len, int nfx, float *fx[], int nout, float *out[]) {
+    AudioHealthShared *health = data;
+    double start = GetTime();
+    int result;
+
+    // the device takes samples at a steady rate while the callbacks come in bursts, so the time a block
+    // starts to play follows from the sample clock with a slowly tracked offset, reset after a dropout
+    double clock_offset = start - (double) health->samples / health->sample_rate;
+    if (health->samples == 0 || fabs(clock_offset - health->clock_offset) > health->xrun_gap) {
+        health->clock_offset = clock_offset;
+    } else {
+        health->clock_offset += (clock_offset - health->clock_offset) / 64.0;
+    }
+    double audible = health->clock_offset + (double) health->samples / health->sample_rate +
+                     atomic_load_explicit(&health->av_offset_usec, memory_order_relaxed) * 1e-6;
+    atomic_store_explicit(&health->audible_usec, (long long) (audible * 1e6), memory_order_relaxed);
+
+    // only the jack driver has separate effect buffers, all others get the effects mixed into the dry ones
+    if (nfx == 0 && nout >= 2) {
+        float *mixed_fx[4] = {out[0], out[1], out[0], out[1]};
+        result = fluid_synth_process(p->fs_synth, len, 4, mixed_fx, nout, out);
+    } else {
+        result = fluid_synth_process(p->fs_synth, len, nfx, fx, nout, out);
+    }
+
+    double end = GetTime();
+    double period = (double) len / health->sample_rate;
+    int render_usec = (int) ((end - start) * 1e6);
+    if (end - start > period) atomic_fetch_add_explicit(&health->late_blocks, 1, memory_order_relaxed);
+    if (health->last_block_start > 0.0 && start - health->last_block_start > health->xrun_gap + period) {
+        atomic_fetch_add_explicit(&health->xruns, 1, memory_order_relaxed);
+    }
+    health->last_block_start = start;
+    health->samples += len;
+
+    long long pending = atomic_exchange_explicit(&health->pending_input_usec, 0, memory_order_relaxed);
+    if (pending != 0) latency_record(&p->input_to_audio, end - (double) pending * 1e-6);
+
+    int max = atomic_load_explicit(&health->render_usec_max, memory_order_relaxed);
+    while (render_usec > max &&
+           !atomic_compare_exchange_weak_explicit(&health->render_usec_max, &max, render_usec,
+                                                  memory_order_relaxed, memory_order_relaxed)) {}
+    atomic_store_explicit(&health->period_usec, (int) (period * 1e6), memory_order_relaxed);
+    atomic_fetch_add_explicit(&health->blocks, 1, memory_order_relaxed);
+    return result;
+}
+
+void start_audio_driver(void) {
+    AudioHealthShared *health = &p->audio_shared;
+    double sample_rate;
+    int period_size;
+    int periods;
+
+    fluid_settings_getnum(p->fs_settings, "synth.sample-rate", &sample_rate);
+    fluid_settings_getint(p->fs_settings, "audio.period-size", &period_size);
+    fluid_settings_getint(p->fs_settings, "audio.periods", &periods);
+    health->sample_rate = sample_rate;
+    health->xrun_gap = (double) (period_size * periods) / sample_rate;
+    health->last_block_start = 0.0;
+    health->samples = 0;
+    atomic_store_explicit(&health->audible_usec, 0, memory_order_relaxed);
+
+    // the driver buffers are all that is known about the output, --av-offset and [ ] cover the rest
+    if (p->av_offset < 0.0) {
+        const char *av_offset = p->options.av_offset;
+        p->av_offset = av_offset == NULL || strcmp(av_offset, "auto") == 0 ? health->xrun_gap : atof(av_offset) / 1000.0;
+    }
+    atomic_store_explicit(&health->av_offset_usec, (int) (p->av_offset * 1e6), memory_order_relaxed);
+
+    char *driver = NULL;
+    fluid_settings_dupstr(p->fs_settings, "audio.driver", &driver);
+    p->fs_audio_driver = new_fluid_audio_driver2(p->fs_settings, audio_callback, health);
+    if (p->fs_audio_driver == NULL) {
+        TraceLog(LOG_ERROR, "FLUIDSYNTH: could not start the %s audio driver", driver != NULL ? driver : "default");
+    } else {
+        // what the buffers add on top of the device itself, drivers that buffer on their own can add more
+        TraceLog(LOG_INFO, "FLUIDSYNTH: %s driver, %d periods of %d samples at %.0f Hz, %.1f ms output latency",
+                 driver != NULL ? driver : "default", periods, period_size, sample_rate, health->xrun_gap * 1000.0);
+        TraceLog(LOG_INFO, "AUDIO: visuals wait %.1f ms for the audio", p->av_offset * 1000.0);
+    }
+    fluid_free(driver);
+}
+
+void stop_audio_driver(void) {
+    if (p->fs_audio_driver == NULL) return;
+    delete_fluid_audio_driver(p->fs_audio_driver);
+    p->fs_audio_driver = NULL;
+}
+
+void start_midi_input(void) {
+    if (p->options.midi_input) {
+        // connect to every device that is plugged in, the alsa sequencer does not do that on its own
+        fluid_settings_setint(p->fs_settings, "midi.autoconnect", 1);
+        p->fs_midi_driver = new_fluid_midi_driver(p->fs_settings, midi_input_callback, NULL);
+        if (p->fs_midi_driver == NULL) TraceLog(LOG_ERROR, "MIDI: could not start the midi driver");
+    }
+    if (p->replay_player != NULL) {
+        fluid_player_set_playback_callback(p->replay_player, midi_input_callback, NULL);
+    }
+}
+
+void stop_midi_input(void) {
+    if (p->fs_midi_driver != NULL) delete_fluid_midi_driver(p->fs_midi_driver);
+    p->fs_midi_driver = NULL;
+}
+
+// A second player that sends its events through the MIDI input path. It runs on fluidsynth's system
+// timer thread, so its notes arrive between audio blocks like the ones of a real device.
+void init_midi_input_replay(void) {
+    char *timing_source = NULL;
+    fluid_settings_dupstr(p->fs_settings, "player.timing-source", &timing_source);
+    fluid_settings_setstr(p->fs_settings, "player.timing-source", "system");
+    p->replay_player = new_fluid_player(p->fs_synth);
+    fluid_settings_setstr(p->fs_settings, "player.timing-source", timing_source != NULL ? timing_source : "sample");
+    fluid_free(timing_source);
+    assert(p->replay_player != NULL && "Failed to make new Fluid player");
+
+    fluid_player_set_playback_callback(p->replay_player, midi_input_callback, NULL);
+    if (fluid_player_add(p->replay_player, p->options.midi_input_replay) != FLUID_OK) {
+        TraceLog(LOG_ERROR, "MIDI: could not replay %s as MIDI input", p->options.midi_input_replay);
+        return;
+    }
+    fluid_player_set_loop(p->replay_player, -1);
+    fluid_player_play(p->replay_player);
+    TraceLog(LOG_INFO, "MIDI: replaying %s as MIDI input", p->options.midi_input_replay);
+}
+
+void log_input_latency(const char *name, LatencyHistogram *histogram) {
+    size_t count = latency_count(histogram);
+    if (count == 0) return;
+
+    TraceLog(LOG_INFO, "MIDI: input to %s: %zu notes, p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms", name, count,
+             latency_percentile(histogram, 0.50) * 1000.0, latency_percentile(histogram, 0.95) * 1000.0,
+             latency_percentile(histogram, 0.99) * 1000.0, latency_max(histogram) * 1000.0);
+    // one line per millisecond that has samples
+    for (size_t ms = 0; ms < LATENCY_BUCKETS * LATENCY_BUCKET_USEC / 1000; ms++) {
+        unsigned n = 0;
+        for (size_t i = ms * 1000 / LATENCY_BUCKET_USEC; i < (ms + 1) * 1000 / LATENCY_BUCKET_USEC; i++) {
+            n += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        }
+        if (n > 0) TraceLog(LOG_INFO, "MIDI:   %3zu-%3zu ms %6u %5.1f%%", ms, ms + 1, n, 100.0 * n / count);
+    }
+}
+
+bool is_offline(void) {
+    return p->options.video_path != NULL || p->options.audio_path != NULL || p->options.benchmark_cores > 0;
+}
+
+bool apply_setting(const char *name, const char *value) {
+    int result = FLUID_FAILED;
+    switch (fluid_settings_get_type(p->fs_settings, name)) {
+        case FLUID_NUM_TYPE:
+            result = fluid_settings_setnum(p->fs_settings, name, atof(value));
+            break;
+        case FLUID_INT_TYPE:
+            result = fluid_settings_setint(p->fs_settings, name, atoi(value));
+            break;
+        case FLUID_STR_TYPE:
+            result = fluid_settings_setstr(p->fs_settings, name, value);
+            break;
+        default:
+            TraceLog(LOG_WARNING, "FLUIDSYNTH: unknown setting %s", name);
+            return false;
+    }
+    if (result != FLUID_OK) TraceLog(LOG_WARNING, "FLUIDSYNTH: invalid value %s for %s", value, name);
+    return result == FLUID_OK;
+}
+
+// Lines of "name = value" (or "name value"), # starts a comment
+void apply_settings_file(const char *file_path) {
+    FILE *file = fopen(file_path, "r");
+    if (file == NULL) {
+        TraceLog(LOG_ERROR, "FLUIDSYNTH: could not open settings file %s", file_path);
+        return;
+    }
+
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char name[64];
+        char value[192];
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        int fields = sscanf(line, " %63[^= \t\r\n] %*[=]%191[^\r\n]", name, value);
+        if (fields != 2) fields = sscanf(line, " %63[^= \t\r\n] %191[^\r\n]", name, value);
+        if (fields == EOF || fields <= 0) continue;
+        if (fields != 2) {
+            TraceLog(LOG_WARNING, "FLUIDSYNTH: %s:%d: expected name = value", file_path, line_number);
+            continue;
+        }
+        // trailing blanks of the value
+        size_t len = strlen(value);
+        while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) value[--len] = '\0';
+        char *start = value;
+        while (*start == ' ' || *start == '\t') start++;
+        apply_setting(name, start);
+    }
+    fclose(file);
+}
+
+// Profile first, then the settings file, then the single options from the command line
+void apply_audio_options(void) {
+    const PlugOptions *opt = &p->options;
+
+    if (opt->latency_profile != NULL) {
+        const LatencyProfile *profile = NULL;
+        for (size_t i = 0; i < sizeof(latency_profiles) / sizeof(latency_profiles[0]); i++) {
+            if (strcmp(latency_profiles[i].name, opt->latency_profile) == 0) profile = &latency_profiles[i];
+        }
+        if (profile != NULL) {
+            fluid_settings_setint(p->fs_settings, "audio.period-size", profile->period_size);
+            fluid_settings_setint(p->fs_settings, "audio.periods", profile->periods);
+            fluid_settings_setnum(p->fs_settings, "synth.sample-rate", profile->sample_rate);
+        } else {
+            TraceLog(LOG_ERROR, "FLUIDSYNTH: unknown latency profile %s, use ultra-low, balanced or safe",
+                     opt->latency_profile);
+        }
+    }
+    if (opt->config_path != NULL) apply_settings_file(opt->config_path);
+
+    if (opt->audio_driver != NULL) apply_setting("audio.driver", opt->audio_driver);
+    if (opt->period_size > 0 && fluid_settings_setint(p->fs_settings, "audio.period-size", opt->period_size) != FLUID_OK) {
+        TraceLog(LOG_WARNING, "FLUIDSYNTH: invalid period size %d", opt->period_size);
+    }
+    if (opt->periods > 0 && fluid_settings_setint(p->fs_settings, "audio.periods", opt->periods) != FLUID_OK) {
+        TraceLog(LOG_WARNING, "FLUIDSYNTH: invalid number of periods %d", opt->periods);
+    }
+    if (opt->sample_rate > 0.0 && fluid_settings_setnum(p->fs_settings, "synth.sample-rate", opt->sample_rate) != FLUID_OK) {
+        TraceLog(LOG_WARNING, "FLUIDSYNTH: invalid sample rate %.0f", opt->sample_rate);
+    }
+}
+
+void init_fluid_synth(void) {
+    p->fs_settings = new_fluid_settings();
+    assert(p->fs_settings != NULL && "Buy more RAM lol");
+    apply_audio_options();
+    if (p->options.dynamic_samples) fluid_settings_setint(p->fs_settings, "synth.dynamic-sample-loading", 1);
+    if (p->options.cpu_cores > 0 && fluid_settings_setint(p->fs_settings, "synth.cpu-cores", p->options.cpu_cores) != FLUID_OK) {
+        TraceLog(LOG_WARNING, "FLUIDSYNTH: invalid number of cpu cores %d", p->options.cpu_cores);
+    }
+
+    if (is_offline()) {
+        // the player has to follow the rendered samples, not the wall clock
+        OfflineAudio *oa = &p->offline_audio;
+        double sample_rate;
+        fluid_settings_setstr(p->fs_settings, "player.timing-source", "sample");
+        fluid_settings_setint(p->fs_settings, "synth.lock-memory", 0);
+        fluid_settings_getnum(p->fs_settings, "synth.sample-rate", &sample_rate);
+        fluid_settings_getint(p->fs_settings, "audio.period-size", &oa->period_size);
+        oa->active = true;
+        oa->sample_rate = (int) sample_rate;
+
+        // one period per video frame keeps audio and frames aligned to the sample
+        int frame_samples = oa->sample_rate / p->options.fps;
+        if (p->options.video_path != NULL && oa->sample_rate % p->options.fps == 0 &&
+            frame_samples >= OFFLINE_PERIOD_MIN && frame_samples <= OFFLINE_PERIOD_MAX) {
+            oa->period_size = frame_samples;
+            fluid_settings_setint(p->fs_settings, "audio.period-size", oa->period_size);
+        }
+        if (p->options.audio_path != NULL) {
+            fluid_settings_setstr(p->fs_settings, "audio.file.name", p->options.audio_path);
+        }
+    }
+
+    p->fs_synth = new_fluid_synth(p->fs_settings);
+    assert(p->fs_synth != NULL && "Buy more RAM lol");
+
+    // when exporting, the synth is driven by render_offline_audio instead of an audio device
+    if (!is_offline()) start_audio_driver();
+}
+
+void reset_keys() {
+    // events queued before a seek/stop would press keys again on the next frame
+    note_ring_clear(&p->note_events);
+    for (size_t i = 0; i < N_KEYS; i++) release_key(i, p->sim.now);
+}
+
+// FNV-1a over the size and the first and last SOUNDFONT_HASH_BYTES of the file, enough to tell fonts apart
+// without reading hundreds of megabytes. 0 when the file cannot be read.
+uint64_t hash_soundfont_file(const char *file_path) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) return 0;
+
+    unsigned char *buffer = malloc(SOUNDFONT_HASH_BYTES);
+    assert(buffer != NULL && "Buy more RAM lol");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    long offsets[2] = {0, size > SOUNDFONT_HASH_BYTES ? size - SOUNDFONT_HASH_BYTES : 0};
+    for (size_t i = 0; i < sizeof(size); i++) {
+        hash = (hash ^ ((uint64_t) size >> (8 * i) & 0xff)) * 0x100000001b3ull;
+    }
+    for (size_t part = 0; part < 2; part++) {
+        fseek(f, offsets[part], SEEK_SET);
+        size_t n = fread(buffer, 1, SOUNDFONT_HASH_BYTES, f);
+        for (size_t i = 0; i < n; i++) hash = (hash ^ buffer[i]) * 0x100000001b3ull;
+    }
+    free(buffer);
+    fclose(f);
+    return hash;
+}
+
+SoundFontEntry *find_soundfont(uint64_t hash) {
+    for (size_t i = 0; i < p->soundfonts.size; i++) {
+        if (p->soundfonts.items[i].hash == hash) return &p->soundfonts.items[i];
+    }
+    return NULL;
+}
+
+void register_soundfont(const char *file_path, uint64_t hash, long long file_size, int id) {
+    SoundFonts *fonts = &p->soundfonts;
+    if (fonts->size == fonts->capacity) {
+        fonts->capacity = fonts->capacity == 0 ? 8 : fonts->capacity * 2;
+        fonts->items = realloc(fonts->items, fonts->capacity * sizeof(*fonts->items));
+        assert(fonts->items != NULL && "Buy more RAM lol");
+    }
+    fonts->items[fonts->size++] = (SoundFontEntry) {
+        .file_path = strdup(file_path), .hash = hash, .file_size = file_size, .id = id, .last_used = GetTime(),
+    };
+}
+
+void remove_soundfont_entry(SoundFontEntry *entry) {
+    SoundFonts *fonts = &p->soundfonts;
+    free(entry->file_path);
+    *entry = fonts->items[--fonts->size];
+}
+
+long long soundfont_file_bytes(void) {
+    long long total = 0;
+    for (size_t i = 0; i < p->soundfonts.size; i++) total += p->soundfonts.items[i].file_size;
+    return total;
+}
+
+// Resident memory of the whole process, -1 where it is not known
+long long resident_bytes(void) {
+#ifdef __linux__
+    long long size = 0;
+    long long resident = -1;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) return -1;
+    if (fscanf(statm, "%lld %lld", &size, &resident) != 2) resident = -1;
+    fclose(statm);
+    return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+// Called right before a soundfont is read, so the growth of resident memory since then is what the fonts keep
+void remember_resident_memory(void) {
+    if (p->resident_before_fonts == 0) p->resident_before_fonts = resident_bytes();
+}
+
+// fluidsynth does not tell how much sample data it holds, not even per preset, so this logs the growth of the
+// whole process since the first font, which includes more than samples
+void log_soundfont_memory(void) {
+    long long resident = resident_bytes();
+    if (resident < 0 || p->resident_before_fonts <= 0) {
+        TraceLog(LOG_INFO, "FLUIDSYNTH: %.1f MB of soundfont files loaded", soundfont_file_bytes() / 1048576.0);
+        return;
+    }
+    TraceLog(LOG_INFO, "FLUIDSYNTH: process grew %.1f MB since the first soundfont (samples and all else), %.1f MB of "
+             "soundfont files", (resident - p->resident_before_fonts) / 1048576.0, soundfont_file_bytes() / 1048576.0);
+}
+
+// With dynamic sample loading only the presets selected on a channel have their samples in memory. Every
+// channel the piece plays starts on the preset of its first note, the others let go of theirs. Presets the
+// piece switches to later are loaded when it gets there. False when there was nothing to select.
+bool select_piece_programs(void) {
+    int dynamic = 0;
+    fluid_settings_getint(p->fs_settings, "synth.dynamic-sample-loading", &dynamic);
+    if (!dynamic || p->note_index.n_notes == 0 || fluid_synth_sfcount(p->fs_synth) == 0) return false;
+
+    int selected = 0;
+    for (int channel = 0; channel < 16; channel++) {
+        const ProgramUse *first = NULL;
+        for (size_t i = 0; i < p->note_index.n_programs && first == NULL; i++) {
+            if (p->note_index.programs[i].channel == channel) first = &p->note_index.programs[i];
+        }
+        if (first != NULL) {
+            fluid_synth_bank_select(p->fs_synth, channel, first->bank);
+            fluid_synth_program_change(p->fs_synth, channel, first->program);
+            selected++;
+        } else if (channel != 0 && !p->options.midi_input && p->options.midi_input_replay == NULL) {
+            // channel 0 is played by clicking the keys, MIDI devices may play on any channel
+            fluid_synth_unset_program(p->fs_synth, channel);
+        }
+    }
+    TraceLog(LOG_INFO, "FLUIDSYNTH: the piece plays %zu presets, starting with %d of them", p->note_index.n_programs,
+             selected);
+    return true;
+}
+
+// Counts which fonts provide the presets selected on the channels. Those and the newest font are in use.
+void count_soundfont_refs(void) {
+    double now = GetTime();
+    for (size_t i = 0; i < p->soundfonts.size; i++) {
+        SoundFontEntry *entry = &p->soundfonts.items[i];
+        entry->refs = entry->id == p->sound_font_id ? 1 : 0;
+    }
+    for (int channel = 0; channel < 16; channel++) {
+        fluid_preset_t *preset = fluid_synth_get_channel_preset(p->fs_synth, channel);
+        if (preset == NULL) continue;
+        int id = fluid_sfont_get_id(fluid_preset_get_sfont(preset));
+        for (size_t i = 0; i < p->soundfonts.size; i++) {
+            if (p->soundfonts.items[i].id == id) p->soundfonts.items[i].refs++;
+        }
+    }
+    for (size_t i = 0; i < p->soundfonts.size; i++) {
+        if (p->soundfonts.items[i].refs > 0) p->soundfonts.items[i].last_used = now;
+    }
+}
+
+// Unloads the least recently used fonts nothing uses until the files fit into the budget.
+// Without a budget, fonts nothing uses are unloaded right away.
+void enforce_soundfont_budget(void) {
+    long long budget = (long long) p->options.soundfont_budget_mb << 20;
+    long long total = soundfont_file_bytes();
+
+    count_soundfont_refs();
+    while (total > budget) {
+        SoundFontEntry *lru = NULL;
+        for (size_t i = 0; i < p->soundfonts.size; i++) {
+            SoundFontEntry *entry = &p->soundfonts.items[i];
+            if (entry->refs == 0 && (lru == NULL || entry->last_used < lru->last_used)) lru = entry;
+        }
+        if (lru == NULL) break;
+
+        // nothing selects its presets, so there is nothing to reset, voices still playing it keep it until they end
+        TraceLog(LOG_INFO, "FLUIDSYNTH: unloading unused sound font file [%s]", lru->file_path);
+        fluid_synth_sfunload(p->fs_synth, lru->id, 0);
+        total -= lru->file_size;
+        remove_soundfont_entry(lru);
+    }
+    if (budget > 0 && total > budget) {
+        TraceLog(LOG_WARNING, "FLUIDSYNTH: %.1f MB of soundfonts in use, over the budget of %d MB", total / 1048576.0,
+                 p->options.soundfont_budget_mb);
+    }
+}
+
+// Forgets the piece prepared to follow the current one, also when the player thread started it already
+void drop_next_piece(void) {
+    if (p->next_player == NULL) return;
+    if (atomic_exchange_explicit(&p->playback_shared.next_player, NULL, memory_order_acq_rel) == NULL) {
+        fluid_player_stop(p->next_player);
+    }
+    delete_fluid_player(p->next_player);
+    note_index_free(&p->next_index);
+    p->next_player = NULL;
+}
+
+// data is the file read into memory, or NULL to let the player read file_path
+fluid_player_t *create_midi_player(const char *file_path, const uint8_t *data, size_t size) {
+    fluid_player_t *player = new_fluid_player(p->fs_synth);
+    assert(player != NULL && "Failed to make new Fluid player");
+    fluid_player_set_playback_callback(player, player_midi_callback, NULL);
+    fluid_player_set_tick_callback(player, player_tick_callback, NULL);
+    if (data != NULL) {
+        // the player copies the buffer and parses it from memory
+        fluid_player_add_mem(player, data, size);
+    } else {
+        fluid_player_add(player, file_path);
+    }
+
+    // an export ends with the piece, interactive playback loops it unless a playlist goes on with the next one
+    fluid_player_set_loop(player, is_offline() || p->playlist.size > 1 ? 1 : -1);
+    return player;
+}
+
+// Makes index, which it takes over, the note index of file_path, the piece fs_player plays now
+void show_piece(const char *file_path, NoteIndex *index, bool indexed) {
+    free((char *) p->current_piece.file_path);
+    p->current_piece.file_path = strdup(file_path);
+
+    note_index_free(&p->note_index);
+    p->note_index = *index;
+    p->current_piece.total_ticks = indexed ? p->note_index.total_ticks : 0;
+    p->current_piece.duration = indexed ? (int) p->note_index.duration : 0;
+    atomic_store_explicit(&p->playback_shared.end_tick, p->current_piece.total_ticks, memory_order_relaxed);
+    p->last_seek_tick = -1;
+    if (indexed) {
+        TraceLog(LOG_INFO, "MIDI: %zu notes in %d tracks, %.1fs", p->note_index.n_notes, p->note_index.n_tracks,
+                 p->note_index.duration);
+        if (select_piece_programs()) {
+            enforce_soundfont_budget();
+            log_soundfont_memory();
+        }
+    } else {
+        TraceLog(LOG_WARNING, "MIDI: could not index the notes of %s, falling notes are not available", file_path);
+    }
+    p->new_piece_loaded = false;
+}
+
+// Replaces the player and the note index with those of file_path right away, cutting off what plays.
+// data is the file read into memory, or NULL to let the player read it. Takes over index.
+void install_midi_file(const char *file_path, const uint8_t *data, size_t size, NoteIndex *index, bool indexed) {
+    drop_next_piece();
+    if (p->fs_player != NULL) {
+        fluid_player_stop(p->fs_player);
+        delete_fluid_player(p->fs_player);
+        fluid_synth_all_notes_off(p->fs_synth, -1);
+        lock_simulation();
+        reset_keys();
+        unlock_simulation();
+    }
+
+    atomic_store_explicit(&p->playback_shared.tick, -1, memory_order_release);
+    disarm_seek();
+    p->fs_player = create_midi_player(file_path, data, size);
+    fluid_player_play(p->fs_player);
+
+    show_piece(file_path, index, indexed);
+    TraceLog(LOG_INFO, "MIDI: Midi file loaded: %s Press P to play/pause", file_path);
+}
+
+// Exports and benchmarks need the piece before their first frame
+void load_midi_file(const char *file_path) {
+    NoteIndex index;
+    bool indexed = note_index_load(&index, file_path);
+    install_midi_file(file_path, NULL, 0, &index, indexed);
+}
+
+uint8_t *read_midi_file(const char *file_path, size_t *size) {
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) return NULL;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = length > 0 ? malloc(length) : NULL;
+    if (data != NULL && fread(data, 1, length, f) != (size_t) length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = data != NULL ? (size_t) length : 0;
+    return data;
+}
+
+void *midi_load_thread(void *data) {
+    MidiLoad *load = data;
+    load->data = read_midi_file(load->file_path, &load->size);
+    load->indexed = note_index_load_mem(&load->index, load->data, load->size);
+    atomic_store_explicit(&load->state, LOAD_DONE, memory_order_release);
+    return NULL;
+}
+
+// Starts reading and indexing file_path in the background, the current piece keeps playing until
+// finish_midi_load swaps it out. A prefetch only prepares the piece to follow the current one.
+void start_midi_load(const char *file_path, bool prefetch) {
+    MidiLoad *load = &p->midi_load;
+    if (atomic_load_explicit(&load->state, memory_order_acquire) != LOAD_IDLE) {
+        TraceLog(LOG_WARNING, "MIDI: still loading %s, ignoring %s", GetFileName(load->file_path), file_path);
+        return;
+    }
+
+    load->file_path = strdup(file_path);
+    load->data = NULL;
+    load->size = 0;
+    load->prefetch = prefetch;
+    atomic_store_explicit(&load->state, LOAD_RUNNING, memory_order_relaxed);
+    load->threaded = pthread_create(&load->thread, NULL, midi_load_thread, load) == 0;
+    if (!load->threaded) {
+        // done right here, finish_midi_load takes it over as if the thread had loaded it
+        TraceLog(LOG_WARNING, "MIDI: could not start a loading thread, loading %s right away", file_path);
+        midi_load_thread(load);
+    }
+}
+
+size_t next_playlist_entry(void) {
+    return (p->playlist.current + 1) % p->playlist.size;
+}
+
+void remove_playlist_entry(size_t i) {
+    Playlist *playlist = &p->playlist;
+    free(playlist->items[i]);
+    memmove(&playlist->items[i], &playlist->items[i + 1], (playlist->size - i - 1) * sizeof(*playlist->items));
+    playlist->size--;
+    if (i < playlist->current) playlist->current--;
+    if (playlist->current >= playlist->size) playlist->current = 0;
+}
+
+// Reads the entry after the current one ahead of time, so it can start the moment the current one ends
+void prefetch_next_piece(void) {
+    if (p->playlist.size < 2 || p->next_player != NULL) return;
+    start_midi_load(p->playlist.items[next_playlist_entry()], true);
+}
+
+// A file of the playlist that could not be read is left out from now on
+void skip_unreadable_piece(bool prefetch) {
+    if (p->playlist.size == 0) return;
+    remove_playlist_entry(prefetch ? next_playlist_entry() : p->playlist.current);
+    if (p->playlist.size == 0) return;
+    if (!prefetch) {
+        start_midi_load(p->playlist.items[p->playlist.current], false);
+    } else if (p->playlist.size > 1) {
+        prefetch_next_piece();
+    } else if (p->fs_player != NULL) {
+        // the only one left loops
+        fluid_player_set_loop(p->fs_player, -1);
+    }
+}
+
+// Swaps a finished load in, or for a prefetch hands the player thread the player to start once the current
+// piece ends. wait blocks until the load is done. Takes the simulation lock, so it is called outside of it.
+void finish_midi_load(bool wait) {
+    MidiLoad *load = &p->midi_load;
+    int state = atomic_load_explicit(&load->state, memory_order_acquire);
+    if (state == LOAD_IDLE || (state == LOAD_RUNNING && !wait)) return;
+
+    if (load->threaded) pthread_join(load->thread, NULL);
+    atomic_store_explicit(&load->state, LOAD_IDLE, memory_order_relaxed);
+    char *file_path = load->file_path;
+    uint8_t *data = load->data;
+    load->data = NULL;
+    load->file_path = NULL;
+
+    if (data == NULL) {
+        TraceLog(LOG_ERROR, "MIDI: could not read %s", file_path);
+        note_index_free(&load->index);
+        skip_unreadable_piece(load->prefetch);
+    } else if (load->prefetch) {
+        p->next_player = create_midi_player(file_path, data, load->size);
+        p->next_index = load->index;
+        p->next_indexed = load->indexed;
+        atomic_store_explicit(&p->playback_shared.next_player, p->next_player, memory_order_release);
+        TraceLog(LOG_INFO, "MIDI: up next: %s", file_path);
+    } else {
+        install_midi_file(file_path, data, load->size, &load->index, load->indexed);
+        prefetch_next_piece();
+    }
+    free(data);
+    free(file_path);
+}
+
+// Drops a load that is still going, its file is not wanted anymore
+void cancel_midi_load(void) {
+    MidiLoad *load = &p->midi_load;
+    if (atomic_load_explicit(&load->state, memory_order_acquire) == LOAD_IDLE) return;
+    if (load->threaded) pthread_join(load->thread, NULL);
+    atomic_store_explicit(&load->state, LOAD_IDLE, memory_order_relaxed);
+    note_index_free(&load->index);
+    free(load->data);
+    free(load->file_path);
+    load->data = NULL;
+    load->file_path = NULL;
+}
+
+// Once per frame: catches up with the piece the player thread started when the current one ended, or
+// starts it when the player thread could not tell the end (a file without note index, a late prefetch)
+void update_playlist(void) {
+    if (p->next_player == NULL) return;
+    bool ended = p->playback.status == FLUID_PLAYER_DONE && p->new_piece_loaded &&
+                 p->playback.tick >= p->current_piece.total_ticks;
+    if (ended) {
+        fluid_player_t *next = atomic_exchange_explicit(&p->playback_shared.next_player, NULL, memory_order_acq_rel);
+        if (next != NULL) fluid_player_play(next);
+    }
+    if (atomic_load_explicit(&p->playback_shared.next_player, memory_order_acquire) != NULL) return;
+
+    // a seek into the last piece must not start its notes in this one
+    disarm_seek();
+    // the last player is gone before show_piece sets end_tick to that of the next piece, its notes
+    // ring out and the keys release with their note offs
+    delete_fluid_player(p->fs_player);
+    p->fs_player = p->next_player;
+    p->next_player = NULL;
+    p->playlist.current = next_playlist_entry();
+    show_piece(p->playlist.items[p->playlist.current], &p->next_index, p->next_indexed);
+    TraceLog(LOG_INFO, "MIDI: now playing %s (%zu of %zu)", p->current_piece.file_path, p->playlist.current + 1,
+             p->playlist.size);
+    prefetch_next_piece();
+}
+
+void append_playlist_entry(Playlist *playlist, const char *file_path) {
+    if (playlist->size >= playlist->capacity) {
+        playlist->capacity = playlist->capacity == 0 ? 16 : playlist->capacity * 2;
+        playlist->items = realloc(playlist->items, playlist->capacity * sizeof(*playlist->items));
+        assert(playlist->items != NULL && "Buy more RAM lol");
+    }
+    playlist->items[playlist->size++] = strdup(file_path);
+}
+
+void free_playlist(Playlist *playlist) {
+    for (size_t i = 0; i < playlist->size; i++) free(playlist->items[i]);
+    free(playlist->items);
+    memset(playlist, 0, sizeof(*playlist));
+}
+
+bool is_playlist_file(const char *file_path) {
+    return IsFileExtension(file_path, ".m3u;.m3u8;.txt");
+}
+
+// One file per line, # starts a comment, relative paths are relative to the playlist file
+void read_playlist_file(Playlist *playlist, const char *file_path) {
+    char *text = LoadFileText(file_path);
+    if (text == NULL) return;
+    char directory[4096];
+    snprintf(directory, sizeof(directory), "%s", GetDirectoryPath(file_path));
+
+    char *line = text;
+    while (*line != '\0') {
+        char *next = line + strcspn(line, "\r\n");
+        bool last = *next == '\0';
+        *next = '\0';
+        line += strspn(line, " \t");
+        if (*line != '\0' && *line != '#') {
+            bool absolute = line[0] == '/' || line[0] == '\\' || line[1] == ':';
+            char entry[4096];
+            snprintf(entry, sizeof(entry), absolute ? "%.0s%s" : "%s/%s", directory, line);
+            if (fluid_is_midifile(entry)) {
+                append_playlist_entry(playlist, entry);
+            } else {
+                TraceLog(LOG_WARNING, "MIDI: %s lists %s, which is no midi file", GetFileName(file_path), entry);
+            }
+        }
+        if (last) break;
+        line = next + 1;
+    }
+    UnloadFileText(text);
+}
+
+// Adds the midi files among paths to the playlist, and those listed by playlist files
+void collect_playlist(Playlist *playlist, const char *const *paths, size_t n_paths) {
+    for (size_t i = 0; i < n_paths; i++) {
+        if (fluid_is_midifile(paths[i])) {
+            append_playlist_entry(playlist, paths[i]);
+        } else if (is_playlist_file(paths[i])) {
+            read_playlist_file(playlist, paths[i]);
+        }
+    }
+}
+
+// Replaces what plays with the first entry of playlist, which it takes over
+void play_playlist(Playlist *playlist) {
+    // a file still loading or up next belongs to the old one
+    cancel_midi_load();
+    drop_next_piece();
+    free_playlist(&p->playlist);
+    p->playlist = *playlist;
+    if (p->playlist.size > 1) TraceLog(LOG_INFO, "MIDI: playlist of %zu files", p->playlist.size);
+    start_midi_load(p->playlist.items[0], false);
+}
+
+// A new font or one brought back to the top: its presets replace those of the others on every channel
+void activate_soundfont(int id) {
+    p->sound_font_id = id;
+    fluid_synth_program_reset(p->fs_synth);
+    select_piece_programs();
+    enforce_soundfont_budget();
+    log_soundfont_memory();
+}
+
+// The font is already loaded: moved to the top of the stack instead of being read again
+void reuse_soundfont(SoundFontEntry *entry, const char *file_path) {
+    fluid_sfont_t *sfont = fluid_synth_get_sfont_by_id(p->fs_synth, entry->id);
+    TraceLog(LOG_INFO, "FLUIDSYNTH: [%s] is loaded already as [%s], using it again", file_path, entry->file_path);
+    if (sfont != NULL && p->sound_font_id != entry->id) {
+        fluid_synth_remove_sfont(p->fs_synth, sfont);
+        entry->id = fluid_synth_add_sfont(p->fs_synth, sfont);
+    }
+    entry->last_used = GetTime();
+    activate_soundfont(entry->id);
+}
+
+void load_soundfont_file(const char *file_path) {
+    uint64_t hash = hash_soundfont_file(file_path);
+    SoundFontEntry *loaded = find_soundfont(hash);
+    if (loaded != NULL) {
+        reuse_soundfont(loaded, file_path);
+        return;
+    }
+
+    remember_resident_memory();
+    int id = fluid_synth_sfload(p->fs_synth, file_path, 0);
+    TraceLog(LOG_INFO, "Sound Font ID: %d", id);
+    if (id == FLUID_FAILED) {
+        TraceLog(LOG_ERROR, "FLUIDSYNTH: failed to load soundfont [%s]", file_path);
+    } else {
+        TraceLog(LOG_INFO, "FLUIDSYNTH: Loaded sound font file [%s]", file_path);
+        register_soundfont(file_path, hash, GetFileLength(file_path), id);
+        activate_soundfont(id);
+    }
+}
+
+// File access of the staging loader, counts what was read for the progress bar
+void *sfont_file_open(const char *filename) {
+    return fopen(filename, "rb");
+}
+
+int sfont_file_read(void *buf, fluid_long_long_t count, void *handle) {
+    char *dst = buf;
+    while (count > 0) {
+        size_t chunk = count < SOUNDFONT_READ_CHUNK ? (size_t) count : SOUNDFONT_READ_CHUNK;
+        if (fread(dst, 1, chunk, handle) != chunk) return FLUID_FAILED;
+        atomic_fetch_add_explicit(&p->sfont_load.bytes_read, (long long) chunk, memory_order_relaxed);
+        dst += chunk;
+        count -= (fluid_long_long_t) chunk;
+    }
+    return FLUID_OK;
+}
+
+int sfont_file_seek(void *handle, fluid_long_long_t offset, int origin) {
+#ifdef _WIN32
+    return _fseeki64(handle, offset, origin) == 0 ? FLUID_OK : FLUID_FAILED;
+#else
+    return fseeko(handle, (off_t) offset, origin) == 0 ? FLUID_OK : FLUID_FAILED;
+#endif
+}
+
+fluid_long_long_t sfont_file_tell(void *handle) {
+#ifdef _WIN32
+    return _ftelli64(handle);
+#else
+    return ftello(handle);
+#endif
+}
+
+int sfont_file_close(void *handle) {
+    return fclose(handle) == 0 ? FLUID_OK : FLUID_FAILED;
+}
+
+void *soundfont_load_thread(void *data) {
+    SoundFontLoad *load = data;
+    fluid_sfont_t *sfont = NULL;
+
+    load->hash = hash_soundfont_file(load->file_path);
+    for (size_t i = 0; i < load->n_known_hashes; i++) {
+        if (load->known_hashes[i] == load->hash) load->duplicate = true;
+    }
+
+    int id = load->duplicate ? FLUID_FAILED : fluid_synth_sfload(load->synth, load->file_path, 0);
+    if (id != FLUID_FAILED) {
+        sfont = fluid_synth_get_sfont_by_id(load->synth, id);
+        // taken out of the staging synth without deleting it, the audio synth takes it over
+        fluid_synth_remove_sfont(load->synth, sfont);
+    }
+    load->sfont = sfont;
+    atomic_store_explicit(&load->state, LOAD_DONE, memory_order_release);
+    return NULL;
+}
+
+// Starts loading file_path in the background, the audio and the frames go on and
+// finish_soundfont_load swaps the font in once it is ready
+void start_soundfont_load(const char *file_path) {
+    SoundFontLoad *load = &p->sfont_load;
+    if (atomic_load_explicit(&load->state, memory_order_acquire) != LOAD_IDLE) {
+        TraceLog(LOG_WARNING, "FLUIDSYNTH: still loading %s, ignoring %s", GetFileName(load->file_path), file_path);
+        return;
+    }
+
+    if (load->synth == NULL) {
+        // never plays, so a single voice and none of the audio synth's threads
+        load->settings = new_fluid_settings();
+        assert(load->settings != NULL && "Buy more RAM lol");
+        fluid_settings_setint(load->settings, "synth.polyphony", 1);
+        load->synth = new_fluid_synth(load->settings);
+        assert(load->synth != NULL && "Buy more RAM lol");
+        load->loader = new_fluid_defsfloader(load->settings);
+        assert(load->loader != NULL && "Buy more RAM lol");
+        fluid_sfloader_set_callbacks(load->loader, sfont_file_open, sfont_file_read, sfont_file_seek, sfont_file_tell,
+                                     sfont_file_close);
+        // tried before the default loader of the staging synth
+        fluid_synth_add_sfloader(load->synth, load->loader);
+    }
+
+    // the staging synth reads the samples the way the audio synth would
+    int dynamic = 0;
+    int lock_memory = 0;
+    fluid_settings_getint(p->fs_settings, "synth.dynamic-sample-loading", &dynamic);
+    fluid_settings_getint(p->fs_settings, "synth.lock-memory", &lock_memory);
+    fluid_settings_setint(load->settings, "synth.dynamic-sample-loading", dynamic);
+    fluid_settings_setint(load->settings, "synth.lock-memory", lock_memory);
+
+    // the thread must not look at the registry, which only the render loop touches
+    load->known_hashes = malloc((p->soundfonts.size + 1) * sizeof(*load->known_hashes));
+    assert(load->known_hashes != NULL && "Buy more RAM lol");
+    for (size_t i = 0; i < p->soundfonts.size; i++) load->known_hashes[i] = p->soundfonts.items[i].hash;
+    load->n_known_hashes = p->soundfonts.size;
+    load->duplicate = false;
+
+    remember_resident_memory();
+    load->file_size = GetFileLength(file_path);
+    load->file_path = strdup(file_path);
+    load->sfont = NULL;
+    atomic_store_explicit(&load->bytes_read, 0, memory_order_relaxed);
+    atomic_store_explicit(&load->state, LOAD_RUNNING, memory_order_relaxed);
+    if (pthread_create(&load->thread, NULL, soundfont_load_thread, load) != 0) {
+        TraceLog(LOG_WARNING, "FLUIDSYNTH: could not start a loading thread, loading %s right away", file_path);
+        atomic_store_explicit(&load->state, LOAD_IDLE, memory_order_relaxed);
+        free(load->file_path);
+        free(load->known_hashes);
+        load->file_path = NULL;
+        load->known_hashes = NULL;
+        load_soundfont_file(file_path);
+        return;
+    }
+    TraceLog(LOG_INFO, "FLUIDSYNTH: loading sound font file [%s] in the background", file_path);
+}
+
+// Hands a finished load over to the audio synth, wait blocks until the load is done
+void finish_soundfont_load(bool wait) {
+    SoundFontLoad *load = &p->sfont_load;
+    int state = atomic_load_explicit(&load->state, memory_order_acquire);
+    if (state == LOAD_IDLE || (state == LOAD_RUNNING && !wait)) return;
+
+    pthread_join(load->thread, NULL);
+    char *file_path = load->file_path;
+    SoundFontEntry *loaded = load->duplicate ? find_soundfont(load->hash) : NULL;
+    free(load->known_hashes);
+    load->known_hashes = NULL;
+    load->file_path = NULL;
+    atomic_store_explicit(&load->state, LOAD_IDLE, memory_order_relaxed);
+
+    if (loaded != NULL) {
+        reuse_soundfont(loaded, file_path);
+    } else if (load->duplicate) {
+        // unloaded while its hash was checked, so it has to be read after all
+        start_soundfont_load(file_path);
+    } else if (load->sfont == NULL) {
+        TraceLog(LOG_ERROR, "FLUIDSYNTH: failed to load soundfont [%s]", file_path);
+    } else {
+        // what fluid_synth_sfload does, in short locks of the synth
+        int id = fluid_synth_add_sfont(p->fs_synth, load->sfont);
+        TraceLog(LOG_INFO, "Sound Font ID: %d", id);
+        TraceLog(LOG_INFO, "FLUIDSYNTH: Loaded sound font file [%s]", file_path);
+        register_soundfont(file_path, load->hash, load->file_size, id);
+        activate_soundfont(id);
+    }
+    load->sfont = NULL;
+    free(file_path);
+}
+
+// After the audio synth, which may still hold fonts read through the loader
+void free_soundfont_loader(void) {
+    SoundFontLoad *load = &p->sfont_load;
+    if (load->synth == NULL) return;
+    delete_fluid_synth(load->synth);
+    delete_fluid_settings(load->settings);
+}
+
+void animate_noise(NoiseAnimation *noise, float dt) {
+    noise->wk_threshold += noise->wk_threshold_mult * dt;
+    if (noise->wk_threshold > 0.9f || noise->wk_threshold < 0.1f) {
+        noise->wk_threshold_mult *= -1.f;
+    }
+    noise->bk_threshold += noise->bk_threshold_mult * dt;
+    if (noise->bk_threshold > 0.9f || noise->bk_threshold < 0.1f) {
+        noise->bk_threshold_mult *= -1.f;
+    }
+    // wrapping keeps the float precise over long sessions
+    noise->time = fmodf(noise->time + dt, 2.f * PI);
+}
+
+// Retires the rects that ended long enough before now to have left the top of the window.
+// Rects retire in creation order, so only the front of each key has to be looked at.
+void retire_scroll_rects(double now) {
+    double visible = (p->keyboard.top - KEY_SCROLL_RECT_OFFSET) / SCROLL_SPEED;
+
+    for (size_t i = 0; i < N_KEYS; i++) {
+        ScrollRects *rects = &p->scroll_rects[i];
+        while (rects->size > 0) {
+            ScrollRect *first = scroll_rect_at(rects, 0);
+            if (!first->finished || now - first->end <= visible) break;
+            retire_scroll_rect(rects);
+        }
+    }
+}
+
+void simulate_tick(void) {
+    p->sim.prev_noise = p->sim.noise;
+    animate_noise(&p->sim.noise, SIM_DT);
+    // a frame may still show the previous tick
+    retire_scroll_rects((double) p->sim.ticks * SIM_DT - SIM_DT);
+    p->sim.ticks++;
+}
+
+// Runs the ticks that fit into the time since the last frame and sets how far the frame is past the
+// last one. With the thread the ticks already ran, only alpha follows the clock.
+void advance_simulation(void) {
+    Simulation *sim = &p->sim;
+
+    if (sim->threaded) {
+        sim->alpha = fminf(fmaxf((float) ((GetTime() - sim->last_tick) / SIM_DT), 0.f), 1.f);
+    } else {
+        sim->accumulator += frame_time();
+        int ticks = 0;
+        while (sim->accumulator >= SIM_DT && ticks < SIM_MAX_TICKS) {
+            simulate_tick();
+            sim->accumulator -= SIM_DT;
+            ticks++;
+        }
+        if (ticks == SIM_MAX_TICKS) sim->accumulator = 0.f;
+        sim->alpha = sim->accumulator / SIM_DT;
+    }
+    // one tick behind, like the interpolated noise
+    sim->now = ((double) sim->ticks - 1.0 + sim->alpha) * SIM_DT;
+}
+
+void *simulation_thread(void *data) {
+    Simulation *sim = data;
+    double next_tick = GetTime();
+
+    while (atomic_load_explicit(&sim->running, memory_order_relaxed)) {
+        pthread_mutex_lock(&sim->lock);
+        simulate_tick();
+        sim->last_tick = next_tick;
+        pthread_mutex_unlock(&sim->lock);
+
+        next_tick += SIM_DT;
+        double wait = next_tick - GetTime();
+        if (wait > 0.0) {
+            WaitTime(wait);
+        } else if (wait < -SIM_MAX_TICKS * SIM_DT) {
+            next_tick = GetTime();
+        }
+    }
+    return NULL;
+}
+
+void start_simulation_thread(void) {
+    Simulation *sim = &p->sim;
+    if (!p->options.sim_thread || sim->threaded || p->video_export.active) return;
+
+    pthread_mutex_init(&sim->lock, NULL);
+    atomic_store_explicit(&sim->running, true, memory_order_relaxed);
+    sim->last_tick = GetTime();
+    sim->threaded = true;
+    if (pthread_create(&sim->thread, NULL, simulation_thread, sim) != 0) {
+        TraceLog(LOG_WARNING, "SIM: could not start the simulation thread, simulating in the render loop");
+        sim->threaded = false;
+        pthread_mutex_destroy(&sim->lock);
+    }
+}
+
+void stop_simulation_thread(void) {
+    Simulation *sim = &p->sim;
+    if (!sim->threaded) return;
+
+    atomic_store_explicit(&sim->running, false, memory_order_relaxed);
+    pthread_join(sim->thread, NULL);
+    pthread_mutex_destroy(&sim->lock);
+    sim->threaded = false;
+    sim->accumulator = 0.f;
+}
+
+// The audio driver and the player call back into this library, which is about to be unloaded
+void *plug_pre_reload(void) {
+    stop_simulation_thread();
+    // the loading threads run code of this library
+    finish_soundfont_load(true);
+    finish_midi_load(true);
+    stop_midi_input();
+    // runs on fluidsynth's timer thread, not the audio driver's, and calls midi_input_callback
+    if (p->replay_player != NULL) fluid_player_stop(p->replay_player);
+    stop_audio_driver();
+    return p;
+}
+
+void plug_post_reload(Plug *pP) {
+    p = pP;
+    if (p->fs_player != NULL) {
+        fluid_player_set_playback_callback(p->fs_player, player_midi_callback, NULL);
+        fluid_player_set_tick_callback(p->fs_player, player_tick_callback, NULL);
+    }
+    if (p->next_player != NULL) {
+        fluid_player_set_playback_callback(p->next_player, player_midi_callback, NULL);
+        fluid_player_set_tick_callback(p->next_player, player_tick_callback, NULL);
+    }
+    if (p->sfont_load.loader != NULL) {
+        // the loaded fonts read their samples through these
+        fluid_sfloader_set_callbacks(p->sfont_load.loader, sfont_file_open, sfont_file_read, sfont_file_seek,
+                                     sfont_file_tell, sfont_file_close);
+    }
+    if (!is_offline()) start_audio_driver();
+    start_midi_input();
+    // start_midi_input pointed it at this library again, it goes on where it stopped
+    if (p->replay_player != NULL) fluid_player_play(p->replay_player);
+    start_simulation_thread();
+}
+
+bool init_offline_audio(void) {
+    OfflineAudio *oa = &p->offline_audio;
+
+    if (p->options.audio_path != NULL) {
+        // fluidsynth picks the file type from the extension when it was built with libsndfile
+        oa->renderer = new_fluid_file_renderer(p->fs_synth);
+        if (oa->renderer == NULL) {
+            TraceLog(LOG_ERROR, "EXPORT: could not create a file renderer for %s", p->options.audio_path);
+            return false;
+        }
+    } else {
+        oa->scratch = malloc(2 * oa->period_size * sizeof(float));
+        assert(oa->scratch != NULL && "Buy more RAM lol");
+    }
+
+    if (p->options.events_path != NULL) {
+        oa->events_file = fopen(p->options.events_path, "w");
+        if (oa->events_file == NULL) {
+            TraceLog(LOG_ERROR, "EXPORT: could not open %s for writing", p->options.events_path);
+            return false;
+        }
+        fprintf(oa->events_file, "sample,seconds,event,key,velocity,channel\n");
+    }
+
+    oa->piece_end = -1;
+    oa->start_time = wall_time();
+    return true;
+}
+
+// Renders whole periods until target samples are done. This runs the player's sample
+// timer, so the note events of that stretch of audio land in the ring on this thread.
+void render_offline_audio(long long target) {
+    OfflineAudio *oa = &p->offline_audio;
+
+    while (oa->samples_rendered < target) {
+        if (oa->renderer != NULL) {
+            if (fluid_file_renderer_process_block(oa->renderer) != FLUID_OK) {
+                TraceLog(LOG_ERROR, "EXPORT: failed to render audio to %s", p->options.audio_path);
+                return;
+            }
+        } else {
+            float *left = oa->scratch;
+            float *right = oa->scratch + oa->period_size;
+            fluid_synth_write_float(p->fs_synth, oa->period_size, left, 0, 1, right, 0, 1);
+        }
+        oa->samples_rendered += oa->period_size;
+    }
+}
+
+// Once the player is done the voices ring out (releases, sustain pedal), for at most EXPORT_TAIL_MAX seconds
+bool offline_audio_tail_done(void) {
+    OfflineAudio *oa = &p->offline_audio;
+    if (p->fs_player != NULL && fluid_player_get_status(p->fs_player) == FLUID_PLAYER_PLAYING) return false;
+    if (oa->piece_end < 0) oa->piece_end = oa->samples_rendered;
+    return fluid_synth_get_active_voice_count(p->fs_synth) == 0 ||
+           oa->samples_rendered - oa->piece_end >= (long long) (EXPORT_TAIL_MAX * oa->sample_rate);
 }
 
-void append_scroll_rect(ScrollRects *arr, ScrollRect sr) {
-    if (arr->size == arr->capacity) {
-        arr->capacity *= 2;
-        arr->scrollRects = realloc(arr->scrollRects, arr->capacity * sizeof(ScrollRect));
+void finish_offline_audio(void) {
+    OfflineAudio *oa = &p->offline_audio;
+    double elapsed = wall_time() - oa->start_time;
+    double rendered = (double) oa->samples_rendered / oa->sample_rate;
+    double tail = oa->piece_end >= 0 ? (double) (oa->samples_rendered - oa->piece_end) / oa->sample_rate : 0.0;
+
+    if (p->options.audio_path != NULL) {
+        TraceLog(LOG_INFO, "EXPORT: %.1fs of audio (%.1fs after the last event) rendered to %s in %.1fs, %.2fx real time",
+                 rendered, tail, p->options.audio_path, elapsed, rendered / elapsed);
     }
-    arr->scrollRects[arr->size++] = sr;
+    if (oa->renderer != NULL) delete_fluid_file_renderer(oa->renderer);
+    if (oa->events_file != NULL) fclose(oa->events_file);
+    free(oa->scratch);
+    memset(oa, 0, sizeof(*oa));
 }
 
-void delete_scroll_rect(ScrollRects *arr, size_t index) {
-    if (index >= arr->size) {
-        TraceLog(LOG_WARNING, "Attempted to delete an invalid index %ld from array with size %ld", index, arr->size);
+void init_video_export(void) {
+    VideoExport *ve = &p->video_export;
+    int width = GetScreenWidth();
+    int height = GetScreenHeight();
+
+    ve->active = true;
+    ve->target = LoadRenderTexture(width, height);
+    ve->writer = video_writer_open(p->options.video_path, width, height, p->options.fps);
+    if (ve->writer == NULL) {
+        TraceLog(LOG_ERROR, "EXPORT: could not open %s for writing", p->options.video_path);
+        ve->finished = true;
         return;
     }
-
-    // Shift elements after index one position to the left
-    for (size_t i = index; i < arr->size - 1; i++) {
-        arr->scrollRects[i] = arr->scrollRects[i + 1];
+    if (!init_offline_audio()) {
+        ve->finished = true;
+        return;
     }
-
-    arr->size--;
+    TraceLog(LOG_INFO, "EXPORT: rendering %s to %s at %dx%d, %d FPS", p->options.midi_path,
+             p->options.video_path, width, height, p->options.fps);
 }
 
-bool is_white(size_t key_octave) {
-    if (key_octave < 5)
-        return key_octave % 2 == 0;
-    return key_octave % 2 != 0;
+// Renders the audio of the next video frame, so its note events are in the ring before it is drawn
+void advance_export_audio(void) {
+    long long target = (long long) (p->video_export.frames + 1) * p->offline_audio.sample_rate / p->options.fps;
+    render_offline_audio(target);
 }
 
-void *plug_pre_reload(void) {
-    return p;
-}
+void finish_export_frame(void) {
+    VideoExport *ve = &p->video_export;
 
-void plug_post_reload(Plug *pP) {
-    p = pP;
+    Image frame = LoadImageFromTexture(ve->target.texture);
+    ImageFlipVertical(&frame);      // render textures are stored bottom row first
+    if (!video_writer_write_frame(ve->writer, frame.data)) {
+        TraceLog(LOG_ERROR, "EXPORT: failed to write frame %zu", ve->frames);
+        ve->finished = true;
+    }
+    UnloadImage(frame);
+    ve->frames++;
+
+    // keep going after the last note until every rect has scrolled out of the picture and the notes rang out
+    bool rang_out = offline_audio_tail_done();
+    if (p->playback.status == FLUID_PLAYER_DONE && p->render_stats.live_rects == 0 && rang_out) {
+        double elapsed = wall_time() - p->offline_audio.start_time;
+        double video_length = (double) ve->frames / p->options.fps;
+        TraceLog(LOG_INFO, "EXPORT: %zu frames (%.1fs of video) in %.1fs, %.2fx real time", ve->frames,
+                 video_length, elapsed, video_length / elapsed);
+        ve->finished = true;
+    }
 }
 
-void calculate_key_rects(void) {
-    whiteKey_width = (((float) GetScreenWidth() - left_offset) - (padding * (N_WHITE_KEYS - 1))) / N_WHITE_KEYS;
-    whiteKey_height = whiteKey_width * WHITE_KEY_WH_RATIO;
+void init_stress_test(void) {
+    StressTest *st = &p->stress;
+    StressOptions options;
 
-    blackKey_width = whiteKey_width * WHITE_BLACK_WIDTH_RATIO;
-    blackKey_height = whiteKey_height * WHITE_BLACK_HEIGHT_RATIO;
+    st->active = true;
+    if (!stress_parse_spec(&options, p->options.stress_spec)) {
+        TraceLog(LOG_ERROR, "STRESS: invalid spec \"%s\", see --help", p->options.stress_spec);
+        st->finished = true;
+        return;
+    }
+    st->results = fopen(p->options.stress_results_path, "w");
+    if (st->results == NULL) {
+        TraceLog(LOG_ERROR, "STRESS: could not open %s for writing", p->options.stress_results_path);
+        st->finished = true;
+        return;
+    }
+    fprintf(st->results, "frame,seconds,notes_per_second,frame_ms,work_ms,live_rects,dropped_rects,voices,cpu_load,xruns\n");
+
+    st->event = new_fluid_midi_event();
+    assert(st->event != NULL && "Buy more RAM lol");
+    stress_init(&st->generator, &options);
+    st->start_time = GetTime();
+    TraceLog(LOG_INFO, "STRESS: %.0f notes/s (+%.0f/s) in chords of %d on keys %d-%d, %.2fs long, for %.0fs",
+             options.notes_per_second, options.ramp, options.chord, options.low_key, options.high_key,
+             options.note_length, options.duration);
+}
 
-    float small_offset = whiteKey_width + padding;
-    for (size_t i = 0; i < N_KEYS; i++) {
-        if (p->keys[i].white) {
-            p->keys[i].key_rect.x = (float) p->keys[i].color_index * (whiteKey_width + padding) + left_offset;
-            p->keys[i].key_rect.y = (float) GetScreenHeight() - whiteKey_height - bottom_offset;
-            p->keys[i].key_rect.width = whiteKey_width;
-            p->keys[i].key_rect.height = whiteKey_height;
+void emit_stress_note(bool on, int key, int velocity, void *user_data) {
+    fluid_midi_event_t *event = user_data;
+    fluid_midi_event_set_type(event, on ? 0x90 : 0x80);
+    fluid_midi_event_set_channel(event, 0);
+    fluid_midi_event_set_key(event, key);
+    fluid_midi_event_set_velocity(event, velocity);
+    handle_midi_event(&p->note_events, event, audible_time(false));
+}
 
-        } else {
-            p->keys[i].key_rect.x =
-                    (p->keys[i - 1].color_index + 1) * small_offset - blackKey_width / 2.f + left_offset;
-            p->keys[i].key_rect.y = (float) GetScreenHeight() - whiteKey_height - bottom_offset;
-            p->keys[i].key_rect.width = blackKey_width;
-            p->keys[i].key_rect.height = blackKey_height;
-        }
+// Plays the generated notes that are due, right before the render loop drains the ring
+void advance_stress_test(void) {
+    StressTest *st = &p->stress;
+    stress_advance(&st->generator, GetTime() - st->start_time, emit_stress_note, st->event);
+}
 
-        for (size_t j = 0; j < p->keys[i].scroll_rects.size; j++) {
-            if (p->keys[i].white) {
-                p->keys[i].scroll_rects.scrollRects[j].rect.width = whiteKey_width;
-            } else {
-                p->keys[i].scroll_rects.scrollRects[j].rect.width = blackKey_width;
-            }
-            p->keys[i].scroll_rects.scrollRects[j].rect.x = p->keys[i].key_rect.x;
+void finish_stress_test(void) {
+    StressTest *st = &p->stress;
+    double elapsed = GetTime() - st->start_time;
+
+    if (st->results != NULL) {
+        TraceLog(LOG_INFO, "STRESS: %zu notes in %.1fs, %zu of %zu frames took longer than %.1f frames", st->generator.notes,
+                 elapsed, st->slow_frames, st->frames, STRESS_SLOW_FRAME);
+        if (st->slow_frames > 0) {
+            TraceLog(LOG_INFO, "STRESS: first dropped frame at %.0f notes/s", st->first_slow_nps);
         }
+        TraceLog(LOG_INFO, "STRESS: results written to %s", p->options.stress_results_path);
+        fclose(st->results);
     }
+    if (st->event != NULL) delete_fluid_midi_event(st->event);
+    stress_free(&st->generator);
+    memset(st, 0, sizeof(*st));
+    st->finished = true;
 }
 
-int player_midi_callback(void *data, fluid_midi_event_t *event) {
-    (void) data;
-    uint8_t status, data1, data2;
-    status = fluid_midi_event_get_type(event);
-    data1 = fluid_midi_event_get_key(event);
-    data2 = fluid_midi_event_get_velocity(event);
-    if (status == 0x80 || (status == 0x90 && data2 == 0x0)) {
-        // Key off
-        p->keys[data1 - 21].pressed = false;
-    }
-
-    if (status == 0x90 && data2 > 0x0) {
-        // Key on
-        ScrollRect sr = {0};
-        size_t key_index = data1 - 21;
-        p->keys[key_index].pressed = true;
-        sr.finished = false;
-        sr.rect.width = p->keys[key_index].white ? whiteKey_width : blackKey_width;
-        sr.rect.height = 1;
-        sr.rect.x = p->keys[key_index].key_rect.x;
-        sr.rect.y = p->keys[key_index].key_rect.y - sr.rect.height - KEY_SCROLL_RECT_OFFSET;
-        append_scroll_rect(&p->keys[key_index].scroll_rects, sr);
+// One row per frame, after the profiler closed it
+void record_stress_frame(void) {
+    StressTest *st = &p->stress;
+    double t = GetTime() - st->start_time;
+    double frame = profiler_last(&p->profiler, PROFILE_FRAME);
+    double work = frame - profiler_last(&p->profiler, PROFILE_END_DRAWING);
+    double nps = stress_notes_per_second(&st->generator, t);
+    size_t dropped_rects = 0;
+    lock_simulation();
+    for (size_t i = 0; i < N_KEYS; i++) dropped_rects += p->scroll_rects[i].dropped;
+    unlock_simulation();
+
+    if (frame > STRESS_SLOW_FRAME / STRESS_TARGET_FPS && st->frames > 0) {
+        if (st->slow_frames == 0) st->first_slow_nps = nps;
+        st->slow_frames++;
     }
+    fprintf(st->results, "%zu,%.4f,%.1f,%.3f,%.3f,%zu,%zu,%d,%.1f,%lld\n", st->frames, t, nps, frame * 1000.0,
+            work * 1000.0, p->render_stats.live_rects, dropped_rects, fluid_synth_get_active_voice_count(p->fs_synth),
+            fluid_synth_get_cpu_load(p->fs_synth), atomic_load_explicit(&p->audio_shared.xruns, memory_order_relaxed));
+    st->frames++;
 
-    return fluid_synth_handle_midi_event(p->fs_synth, event);
+    if (stress_done(&st->generator, t) && p->render_stats.live_rects == 0) finish_stress_test();
 }
 
-int player_tick_callback(void *data, int tick) {
-    (void) data;
-    (void) tick;
-    // fluid_player_t* player = (fluid_player_t*)data;
-    if (!p->new_piece_loaded) {
-        p->current_piece.total_ticks = fluid_player_get_total_ticks(p->fs_player);
-        p->current_piece.progress = 0.f;
-        p->current_piece.duration = (float) (p->current_piece.total_ticks / fluid_player_get_division(p->fs_player)) /
-                                    (float) fluid_player_get_bpm(p->fs_player) * 60.f;
-        p->new_piece_loaded = true;
-    }
-    return FLUID_OK;
+bool plug_finished(void) {
+    return p->video_export.finished || p->stress.finished;
 }
 
-void init_ui(void) {
-    int screen_width = GetScreenWidth();
-    int screen_height = GetScreenHeight();
-    float slider_padding;
-    float slider_height;
-
-    p->ui.timeline.bounds = CLITERAL(Rectangle)
-    {
-        .x = 0,
-        .y = screen_height * 0.9f,
-        .width = screen_width * 0.8f,
-        .height = screen_height * 0.1f
-    };
-
-    slider_padding = p->ui.timeline.bounds.width * 0.1f / 2.f;
-    slider_height = p->ui.timeline.bounds.height * 0.1f;
-    p->ui.timeline.slider.bounds = CLITERAL(Rectangle)
-    {
-        .x = p->ui.timeline.bounds.x + slider_padding,
-        .y = p->ui.timeline.bounds.y + (p->ui.timeline.bounds.height / 2.f) - (slider_height / 2.f),
-        .width = p->ui.timeline.bounds.width - 2.f * slider_padding,
-        .height = slider_height
-    };
-
-    p->ui.volume_slider.bounds = CLITERAL(Rectangle)
-    {
-        .x = p->ui.timeline.bounds.width,
-        .y = p->ui.timeline.bounds.y,
-        .width = screen_width - p->ui.timeline.bounds.width,
-        .height = p->ui.timeline.bounds.height
-    };
-
-    slider_padding = p->ui.volume_slider.bounds.width * 0.1f / 2.f;
-    slider_height = p->ui.volume_slider.bounds.height * 0.1f;
-    p->ui.volume_slider.slider.bounds = CLITERAL(Rectangle)
-    {
-        .x = p->ui.volume_slider.bounds.x + slider_padding,
-        .y = p->ui.volume_slider.bounds.y + (p->ui.volume_slider.bounds.height / 2.f) - (slider_height / 2.f),
-        .width = p->ui.volume_slider.bounds.width - 2.f * slider_padding,
-        .height = slider_height
+void create_plug(const PlugOptions *options) {
+    p = malloc(sizeof(*p));
+    assert(p != NULL && "Buy more RAM lol");
+    memset(p, 0, sizeof(*p));
+    p->options = *options;
+    p->falling_notes = options->falling_notes;
+    atomic_init(&p->note_events.head, 0);
+    atomic_init(&p->note_events.tail, 0);
+    atomic_init(&p->note_events.overflows, 0);
+    atomic_init(&p->playback_shared.tick, -1);
+    atomic_init(&p->playback_shared.seek_tick, -1);
+    atomic_init(&p->playback_shared.seek_from, 0);
+    atomic_init(&p->playback_shared.replaying, false);
+    atomic_init(&p->playback_shared.end_tick, 0);
+    atomic_init(&p->playback_shared.next_player, NULL);
+    atomic_init(&p->audio_shared.blocks, 0);
+    atomic_init(&p->audio_shared.late_blocks, 0);
+    atomic_init(&p->audio_shared.xruns, 0);
+    atomic_init(&p->audio_shared.render_usec_max, 0);
+    atomic_init(&p->audio_shared.period_usec, 0);
+    atomic_init(&p->audio_shared.pending_input_usec, 0);
+    atomic_init(&p->audio_shared.av_offset_usec, 0);
+    atomic_init(&p->audio_shared.audible_usec, 0);
+    atomic_init(&p->sfont_load.state, LOAD_IDLE);
+    atomic_init(&p->midi_load.state, LOAD_IDLE);
+    atomic_init(&p->sfont_load.bytes_read, 0);
+    p->av_offset = -1.0;
+    atomic_init(&p->midi_input_events.head, 0);
+    atomic_init(&p->midi_input_events.tail, 0);
+    atomic_init(&p->midi_input_events.overflows, 0);
+    latency_init(&p->input_to_audio);
+    latency_init(&p->input_to_frame);
+    p->sim.noise = (NoiseAnimation) {
+        .wk_threshold = 0.6f,
+        .bk_threshold = 0.4f,
+        .wk_threshold_mult = 0.2f,
+        .bk_threshold_mult = -0.2f,
     };
-    bottom_offset = screen_height - p->ui.timeline.bounds.y;
-    // left_offset = 100.f;
+    p->sim.prev_noise = p->sim.noise;
+    atomic_init(&p->sim.running, false);
 }
 
+// Renders options->midi_path into options->audio_path as fast as possible, without a window or audio device
+bool plug_export_audio(const PlugOptions *options) {
+    NoteEvent ev;
+    bool ok = true;
 
-void init_keys(void) {
-    whiteKey_width = (((float) GetScreenWidth() - left_offset) - (padding * (N_WHITE_KEYS - 1))) / N_WHITE_KEYS;
-    whiteKey_height = whiteKey_width * WHITE_KEY_WH_RATIO;
+    create_plug(options);
+    init_fluid_synth();
+    if (init_offline_audio()) {
+        if (p->options.soundfont_path != NULL) load_soundfont_file(p->options.soundfont_path);
+        load_midi_file(p->options.midi_path);
 
-    blackKey_width = whiteKey_width * WHITE_BLACK_WIDTH_RATIO;
-    blackKey_height = whiteKey_height * WHITE_BLACK_HEIGHT_RATIO;
+        while (!offline_audio_tail_done()) {
+            render_offline_audio(p->offline_audio.samples_rendered + p->offline_audio.period_size);
+            while (note_ring_pop(&p->note_events, &ev)) log_note_event(&ev);
+        }
+    } else {
+        ok = false;
+    }
 
-    float small_offset = whiteKey_width + padding;
-    size_t black_index = 0;
-    size_t white_index = 0;
-    for (size_t i = 0; i < N_KEYS; i++) {
-        p->keys[i].index = i;
-        p->keys[i].pressed = false;
-        p->keys[i].key_oct = (i + 9) % KEYS_IN_OCTAVE;
-        if (is_white(p->keys[i].key_oct)) {
-            p->keys[i].white = true;
-            p->keys[i].color_index = white_index;
-
-            // set up the key rectangle (needed for mouse hit detection)
-            p->keys[i].key_rect.x = (float) p->keys[i].color_index * (whiteKey_width + padding) + left_offset;
-            p->keys[i].key_rect.y = (float) GetScreenHeight() - whiteKey_height - bottom_offset;
-            p->keys[i].key_rect.width = whiteKey_width;
-            p->keys[i].key_rect.height = whiteKey_height;
-
-            p->white_keys[white_index] = &p->keys[i];
-            white_index++;
-        } else {
-            p->keys[i].white = false;
-            p->keys[i].color_index = black_index;
+    finish_offline_audio();
+    if (p->fs_player != NULL) delete_fluid_player(p->fs_player);
+    delete_fluid_synth(p->fs_synth);
+    delete_fluid_settings(p->fs_settings);
+    free((char *) p->current_piece.file_path);
+    note_index_free(&p->note_index);
+    free(p);
+    p = NULL;
+    return ok;
+}
+
+// One pass over the piece with a fixed number of cores
+typedef struct {
+    int cores;
+    double elapsed;
+    double rendered;                    // seconds of audio
+    double worst_block;
+    double period;
+    double bucket_time[BENCHMARK_BUCKETS];
+    size_t bucket_blocks[BENCHMARK_BUCKETS];
+} BenchmarkRun;
+
+void run_benchmark(BenchmarkRun *run) {
+    OfflineAudio *oa = &p->offline_audio;
+
+    p->options.cpu_cores = run->cores;
+    init_fluid_synth();
+    if (!init_offline_audio()) return;
+    if (p->options.soundfont_path != NULL) load_soundfont_file(p->options.soundfont_path);
+    load_midi_file(p->options.midi_path);
+    run->period = (double) oa->period_size / oa->sample_rate;
+
+    while (fluid_player_get_status(p->fs_player) == FLUID_PLAYER_PLAYING) {
+        double start = wall_time();
+        render_offline_audio(oa->samples_rendered + oa->period_size);
+        double block = wall_time() - start;
+        // nobody draws the notes, the ring only has to stay empty
+        note_ring_clear(&p->note_events);
+
+        size_t bucket = fluid_synth_get_active_voice_count(p->fs_synth) / BENCHMARK_VOICE_BUCKET;
+        if (bucket >= BENCHMARK_BUCKETS) bucket = BENCHMARK_BUCKETS - 1;
+        run->bucket_time[bucket] += block;
+        run->bucket_blocks[bucket]++;
+        if (block > run->worst_block) run->worst_block = block;
+    }
+    run->elapsed = wall_time() - oa->start_time;
+    run->rendered = (double) oa->samples_rendered / oa->sample_rate;
 
-            // key rect
-            p->keys[i].key_rect.x =
-                    (p->keys[i - 1].color_index + 1) * small_offset - blackKey_width / 2.f + left_offset;
-            p->keys[i].key_rect.y = (float) GetScreenHeight() - whiteKey_height - bottom_offset;
-            p->keys[i].key_rect.width = blackKey_width;
-            p->keys[i].key_rect.height = blackKey_height;
+    finish_offline_audio();
+    delete_fluid_player(p->fs_player);
+    p->fs_player = NULL;
+    delete_fluid_synth(p->fs_synth);
+    delete_fluid_settings(p->fs_settings);
+}
 
-            p->black_keys[black_index] = &p->keys[i];
-            black_index++;
+// Lowest voice count from which run renders every populated bucket faster than baseline, -1 if it never does
+int benchmark_crossover(const BenchmarkRun *baseline, const BenchmarkRun *run) {
+    int crossover = -1;
+    for (int bucket = BENCHMARK_BUCKETS - 1; bucket >= 0; bucket--) {
+        if (baseline->bucket_blocks[bucket] < BENCHMARK_MIN_BLOCKS || run->bucket_blocks[bucket] < BENCHMARK_MIN_BLOCKS) {
+            continue;
         }
-        init_sr_array(&p->keys[i].scroll_rects, SCROLL_RECT_CAP);
+        double base_mean = baseline->bucket_time[bucket] / baseline->bucket_blocks[bucket];
+        double run_mean = run->bucket_time[bucket] / run->bucket_blocks[bucket];
+        if (run_mean >= base_mean) break;
+        crossover = bucket * BENCHMARK_VOICE_BUCKET;
     }
+    return crossover;
 }
 
-void init_fluid_synth(void) {
-    p->fs_settings = new_fluid_settings();
-    assert(p->fs_settings != NULL && "Buy more RAM lol");
+// Renders options->midi_path offline once per core count, without a window or audio device
+bool plug_benchmark(const PlugOptions *options) {
+    int max_cores = options->benchmark_cores;
+    BenchmarkRun *runs = calloc(max_cores, sizeof(*runs));
+    assert(runs != NULL && "Buy more RAM lol");
+
+    create_plug(options);
+    for (int i = 0; i < max_cores; i++) {
+        runs[i].cores = i + 1;
+        run_benchmark(&runs[i]);
+        if (runs[i].elapsed <= 0.0) break;
+
+        TraceLog(LOG_INFO, "BENCHMARK: %d cores: %.1fs of audio in %.2fs, %.2fx real time, worst block %.3f of %.3f ms",
+                 runs[i].cores, runs[i].rendered, runs[i].elapsed, runs[i].rendered / runs[i].elapsed,
+                 runs[i].worst_block * 1000.0, runs[i].period * 1000.0);
+    }
 
-    p->fs_synth = new_fluid_synth(p->fs_settings);
-    assert(p->fs_synth != NULL && "Buy more RAM lol");
+    bool ok = runs[0].elapsed > 0.0;
+    for (int i = 1; ok && i < max_cores && runs[i].elapsed > 0.0; i++) {
+        int crossover = benchmark_crossover(&runs[0], &runs[i]);
+        if (crossover >= 0) {
+            TraceLog(LOG_INFO, "BENCHMARK: %d cores beat 1 core from %d active voices on", runs[i].cores, crossover);
+        } else {
+            TraceLog(LOG_INFO, "BENCHMARK: %d cores never beat 1 core on this piece", runs[i].cores);
+        }
+    }
 
-    p->fs_audio_driver = new_fluid_audio_driver(p->fs_settings, p->fs_synth);
-    assert(p->fs_audio_driver != NULL && "Buy more RAM lol");
+    free((char *) p->current_piece.file_path);
+    note_index_free(&p->note_index);
+    free(p);
+    p = NULL;
+    free(runs);
+    return ok;
 }
 
-void plug_init(void) {
-    p = malloc(sizeof(*p));
-    assert(p != NULL && "Buy more RAM lol");
-    memset(p, 0, sizeof(*p));
+// The key shaders only have their main, the noise they share is put in front of it
+Shader load_key_shader(const char *noise, const char *file_path) {
+    char *key_main = LoadFileText(file_path);
+    if (noise == NULL || key_main == NULL) {
+        TraceLog(LOG_WARNING, "SHADER: could not read the sources of %s", file_path);
+        UnloadFileText(key_main);
+        return LoadShader(NULL, NULL);
+    }
+    size_t size = strlen(noise) + strlen(key_main) + 2;
+    char *source = malloc(size);
+    assert(source != NULL && "Buy more RAM lol");
+    snprintf(source, size, "%s\n%s", noise, key_main);
+    Shader shader = LoadShaderFromMemory(NULL, source);
+    free(source);
+    UnloadFileText(key_main);
+    return shader;
+}
+
+void plug_init(const PlugOptions *options) {
+    create_plug(options);
 
     p->font = LoadFontEx("../resources/fonts/LouisGeorgeCafe.ttf", FONT_SIZE, NULL, 0);
     GenTextureMipmaps(&p->font.texture);
@@ -368,34 +2421,79 @@ void plug_init(void) {
     init_keys();
     init_fluid_synth();
 
-    p->wk_shader = LoadShader(NULL, "../resources/shaders/white_keys.frag");
-    p->bk_shader = LoadShader(NULL, "../resources/shaders/black_keys.frag");
+    char *noise = LoadFileText("../resources/shaders/noise.glsl");
+    p->wk_shader = load_key_shader(noise, "../resources/shaders/white_keys.frag");
+    p->bk_shader = load_key_shader(noise, "../resources/shaders/black_keys.frag");
+    UnloadFileText(noise);
 
     wk_perlin_threshold_loc = GetShaderLocation(p->wk_shader, "perlin_treshold");
     bk_perlin_threshold_loc = GetShaderLocation(p->bk_shader, "perlin_treshold");
-
-    int monitor_width = GetMonitorWidth(GetCurrentMonitor());
-    int monitor_height = GetMonitorHeight(GetCurrentMonitor());
-    perlin_image = GenImagePerlinNoise(monitor_width, monitor_height, 0, 0, 5);
-    perlin_texture = LoadTextureFromImage(perlin_image);
-
-    perlin_offset_x = (monitor_width - GetScreenWidth()) / 2;
-    perlin_offset_y = (monitor_height - GetScreenHeight()) / 2;
+    wk_perlin_time_loc = GetShaderLocation(p->wk_shader, "time");
+    bk_perlin_time_loc = GetShaderLocation(p->bk_shader, "time");
+
+    if (p->options.video_path != NULL) init_video_export();
+    // an export has to hear the font from its first sample, live the window shows up while it loads
+    if (p->options.soundfont_path != NULL && is_offline()) load_soundfont_file(p->options.soundfont_path);
+    if (p->options.soundfont_path != NULL && !is_offline()) start_soundfont_load(p->options.soundfont_path);
+    if (p->options.midi_path != NULL && is_offline()) load_midi_file(p->options.midi_path);
+    if (p->options.midi_path != NULL && !is_offline()) {
+        Playlist playlist = {0};
+        collect_playlist(&playlist, &p->options.midi_path, 1);
+        if (playlist.size > 0) {
+            play_playlist(&playlist);
+        } else {
+            TraceLog(LOG_ERROR, "MIDI: %s is neither a midi file nor a playlist of them", p->options.midi_path);
+        }
+    }
+    if (p->options.stress_spec != NULL) init_stress_test();
+    if (p->options.midi_input_replay != NULL) init_midi_input_replay();
+    start_midi_input();
+    start_simulation_thread();
 
     // default_texture = CLITERAL(Texture){ rlGetTextureIdDefault(), 1, 1, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8 };
 
 }
 
 void plug_clean(void) {
-    delete_fluid_audio_driver(p->fs_audio_driver);
+    if (p->video_export.active) {
+        video_writer_close(p->video_export.writer);
+        UnloadRenderTexture(p->video_export.target);
+    }
+    if (p->offline_audio.active) finish_offline_audio();
+    stop_simulation_thread();
+    finish_soundfont_load(true);
+    cancel_midi_load();
+    drop_next_piece();
+    free_playlist(&p->playlist);
+    if (p->stress.active) finish_stress_test();
+    stop_midi_input();
+    if (p->replay_player != NULL) {
+        fluid_player_stop(p->replay_player);
+        delete_fluid_player(p->replay_player);
+    }
+    log_input_latency("audio", &p->input_to_audio);
+    log_input_latency("screen", &p->input_to_frame);
+    if (p->fs_audio_driver != NULL) {
+        stop_audio_driver();
+        TraceLog(LOG_INFO, "AUDIO: %lld blocks, %lld late, %lld xruns",
+                 atomic_load_explicit(&p->audio_shared.blocks, memory_order_relaxed),
+                 atomic_load_explicit(&p->audio_shared.late_blocks, memory_order_relaxed),
+                 atomic_load_explicit(&p->audio_shared.xruns, memory_order_relaxed));
+    }
     delete_fluid_player(p->fs_player);
     delete_fluid_synth(p->fs_synth);
+    free_soundfont_loader();
     delete_fluid_settings(p->fs_settings);
+    for (size_t i = 0; i < p->soundfonts.size; i++) free(p->soundfonts.items[i].file_path);
+    free(p->soundfonts.items);
     UnloadFont(p->font);
-    UnloadTexture(perlin_texture);
-    UnloadImage(perlin_image);
     UnloadShader(p->wk_shader);
     UnloadShader(p->bk_shader);
+    free(p->scroll_rect_pool);
+    free((char *) p->current_piece.file_path);
+    note_index_free(&p->note_index);
+    free(p->visible_white_rects.items);
+    free(p->visible_black_rects.items);
     free(p);
 }
 
@@ -413,199 +2511,374 @@ float pos_to_volume(float pos) {
     return (pos - 0.5f) * 2 * (GAIN_MAX - 1) + 1;
 }
 
-void render_key(Key *key) {
+void render_key(size_t i) {
+    const Keyboard *kb = &p->keyboard;
     Color topColor;
     Color bottomColor;
 
-    if (key->white) {
+    if (kb->white[i]) {
         topColor = WHITE;
-        bottomColor = key->pressed ? GRAY : topColor;
-        DrawRectangleGradientV(key->key_rect.x, key->key_rect.y, key->key_rect.width, key->key_rect.height, topColor,
-                               bottomColor);
+        bottomColor = kb->pressed[i] ? GRAY : topColor;
     } else {
         topColor = CLITERAL(Color)
         { 50, 50, 50, 255 };
-        bottomColor = key->pressed ? BLACK : topColor;
-        DrawRectangleGradientV(key->key_rect.x, key->key_rect.y, key->key_rect.width, key->key_rect.height, topColor,
-                               bottomColor);
+        bottomColor = kb->pressed[i] ? BLACK : topColor;
     }
+    DrawRectangleGradientV(kb->x[i], kb->top, kb->width[i], kb->height[i], topColor, bottomColor);
 }
 
-void reset_keys() {
-    for (size_t i = 0; i < N_KEYS; i++) {
-        p->keys[i].pressed = false;
+void render_keys() {
+    for (size_t n = 0; n < N_WHITE_KEYS; n++) {
+        render_key(p->keyboard.white_keys[n]);  // Render all white keys before all black keys to avoid overlapping
+    }
+
+    for (size_t n = 0; n < N_BLACK_KEYS; n++) {
+        render_key(p->keyboard.black_keys[n]);
     }
 }
 
-void render_keys() {
-    for (size_t i = 0; i < N_WHITE_KEYS; i++) {
-        render_key(p->white_keys[i]);          // Render all white keys before all black keys to avoid overlapping
+// The key under pos, straight from the layout: the white key from the x coordinate, then the black keys on
+// either side of it, which cover the upper part of the white key's edges. -1 when there is none.
+int key_at(Vector2 pos) {
+    const Keyboard *kb = &p->keyboard;
+    float x = pos.x - left_offset;
+    float stride = kb->white_width + padding;
+    if (pos.y < kb->top || pos.y >= kb->top + kb->white_height || x < 0.f) return -1;
+
+    size_t white = (size_t) (x / stride);
+    if (white >= N_WHITE_KEYS) return -1;
+    int index = kb->white_keys[white];
+
+    if (pos.y < kb->top + kb->black_height) {
+        if (index + 1 < N_KEYS && !kb->white[index + 1] && x >= (white + 1) * stride - kb->black_width / 2.f) {
+            return index + 1;
+        }
+        if (index > 0 && !kb->white[index - 1] && x < white * stride + kb->black_width / 2.f) {
+            return index - 1;
+        }
     }
+    // the gap between two white keys
+    if (x - white * stride >= kb->white_width) return -1;
+    return index;
+}
 
-    for (size_t i = 0; i < N_BLACK_KEYS; i++) {
-        render_key(p->black_keys[i]);
+bool key_held_by_other_pointer(int key, const Pointer *pointer) {
+    for (size_t i = 0; i < p->n_pointers; i++) {
+        if (&p->pointers[i] != pointer && p->pointers[i].key == key) return true;
     }
+    return false;
+}
+
+void release_pointer_key(Pointer *pointer) {
+    int key = pointer->key;
+    pointer->key = -1;
+    if (key < 0 || key_held_by_other_pointer(key, pointer)) return;
+    release_key(key, p->sim.now);
+    fluid_synth_noteoff(p->fs_synth, 0, key + 21);
+}
+
+void press_pointer_key(Pointer *pointer, int key) {
+    pointer->key = key;
+    if (key < 0 || p->keyboard.pressed[key]) return;
+    // the key goes down under the pointer right away, only notes from the player and MIDI input wait for the audio
+    fluid_synth_noteon(p->fs_synth, 0, key + 21, 80);
+    press_key(key, p->sim.now);
 }
 
-// handles mouse input, creating scroll rects and playing notes with fluidsynth if a key was newly pressed
+// Every touch point (or the mouse, when nothing touches the screen) holds its own key
 void update_keys() {
-    bool black_pressed = false;
-    ScrollRect sr = {0};
+    int ids[MAX_POINTERS];
+    Vector2 positions[MAX_POINTERS];
+    size_t n_points = 0;
+
+    int touch_points = GetTouchPointCount();
+    for (int i = 0; i < touch_points && n_points < MAX_POINTERS; i++) {
+        ids[n_points] = GetTouchPointId(i);
+        positions[n_points] = GetTouchPosition(i);
+        n_points++;
+    }
+    if (n_points == 0 && IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+        ids[n_points] = -1;
+        positions[n_points] = GetMousePosition();
+        n_points++;
+    }
 
-    if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-        if (p->last_pressed_key != NULL) {
-            p->last_pressed_key->pressed = false;
-            // turn off note in fluidsynth
-            fluid_synth_noteoff(p->fs_synth, 0, p->last_pressed_key->index + 21);
-        }
-    } else {
-        for (size_t i = 0; i < N_BLACK_KEYS; i++) {
-            if (CheckCollisionPointRec(GetMousePosition(), p->black_keys[i]->key_rect)) {
-                if (!p->black_keys[i]->pressed) {
-                    if (p->last_pressed_key != NULL) {
-                        p->last_pressed_key->pressed = false;
-                        fluid_synth_noteoff(p->fs_synth, 0, p->last_pressed_key->index + 21);
-                    }
-                    p->black_keys[i]->pressed = true;
-                    p->last_pressed_key = p->black_keys[i];
-
-                    // create sound with fluidsynth
-                    fluid_synth_noteon(p->fs_synth, 0, p->black_keys[i]->index + 21, 80);
-
-                    // Create the Scroll Rect
-                    sr.finished = false;
-                    sr.rect.width = blackKey_width;
-                    sr.rect.height = 1;
-                    sr.rect.x = p->black_keys[i]->key_rect.x;
-                    sr.rect.y = p->black_keys[i]->key_rect.y - sr.rect.height - KEY_SCROLL_RECT_OFFSET;
-                    append_scroll_rect(&p->black_keys[i]->scroll_rects, sr);
-                }
-                black_pressed = true;                           // prevent white key being pressed through black key
-            }
+    // pointers that moved or went away
+    for (size_t i = 0; i < p->n_pointers;) {
+        Pointer *pointer = &p->pointers[i];
+        size_t point = 0;
+        while (point < n_points && ids[point] != pointer->id) point++;
+
+        if (point == n_points) {
+            release_pointer_key(pointer);
+            p->pointers[i] = p->pointers[--p->n_pointers];
+            continue;
         }
-        if (!black_pressed) {
-            for (size_t i = 0; i < N_WHITE_KEYS; i++) {
-                if (CheckCollisionPointRec(GetMousePosition(), p->white_keys[i]->key_rect)) {
-                    if (!p->white_keys[i]->pressed) {
-                        if (p->last_pressed_key != NULL) {
-                            p->last_pressed_key->pressed = false;
-                            fluid_synth_noteoff(p->fs_synth, 0, p->last_pressed_key->index + 21);
-                        }
-                        p->white_keys[i]->pressed = true;
-                        p->last_pressed_key = p->white_keys[i];
-
-                        // create sound with fluidsynth.
-                        fluid_synth_noteon(p->fs_synth, 0, p->white_keys[i]->index + 21, 80);
-
-                        // Create the Scroll Rect
-                        sr.finished = false;
-                        sr.rect.width = whiteKey_width;
-                        sr.rect.height = 1;
-                        sr.rect.x = p->white_keys[i]->key_rect.x;
-                        sr.rect.y = p->white_keys[i]->key_rect.y - sr.rect.height - KEY_SCROLL_RECT_OFFSET;
-                        append_scroll_rect(&p->white_keys[i]->scroll_rects, sr);
-                    }
-                }
-            }
+        int key = key_at(positions[point]);
+        if (key != pointer->key) {
+            release_pointer_key(pointer);
+            press_pointer_key(pointer, key);
         }
+        ids[point] = ids[--n_points];
+        positions[point] = positions[n_points];
+        i++;
     }
-}
 
-void render_scroll_rects() {
-    wk_perlin_threshold += wk_perlin_threshold_mult * GetFrameTime();
-    if (wk_perlin_threshold > 0.9f || wk_perlin_threshold < 0.1f) {
-        wk_perlin_threshold_mult *= -1.f;
+    // the ones left are new
+    for (size_t point = 0; point < n_points && p->n_pointers < MAX_POINTERS; point++) {
+        Pointer *pointer = &p->pointers[p->n_pointers++];
+        pointer->id = ids[point];
+        pointer->key = -1;
+        press_pointer_key(pointer, key_at(positions[point]));
     }
-    bk_perlin_threshold += bk_perlin_threshold_mult * GetFrameTime();
-    if (bk_perlin_threshold > 0.9f || bk_perlin_threshold < 0.1f) {
-        bk_perlin_threshold_mult *= -1.f;
+}
+
+// Makes room for count vertices in the active rlgl batch, counting the flush if one was needed
+void reserve_batch_vertices(int count) {
+    if (rlCheckRenderBatchLimit(count)) {
+        p->render_stats.batch_flushes++;
+        p->render_stats.draw_calls++;
     }
-    SetShaderValue(p->wk_shader, wk_perlin_threshold_loc, &wk_perlin_threshold, SHADER_UNIFORM_FLOAT);
-    SetShaderValue(p->bk_shader, bk_perlin_threshold_loc, &bk_perlin_threshold, SHADER_UNIFORM_FLOAT);
+}
 
-    Rectangle current_rect;
-    Rectangle source_rect;
-    perlin_dt += GetFrameTime();
-    float source_offset_x = sinf(perlin_dt) * 320 + perlin_offset_x;
-    float source_offset_y = cosf(perlin_dt) * 180 + perlin_offset_y;
+// Submits everything accumulated so far as one draw
+void flush_batch(size_t n_rects) {
+    rlDrawRenderBatchActive();
+    if (n_rects > 0) p->render_stats.draw_calls++;
+}
 
-    BeginShaderMode(p->wk_shader);
-    for (size_t i = 0; i < N_WHITE_KEYS; i++) {
-        for (size_t j = 0; j < p->white_keys[i]->scroll_rects.size; j++) {
-            current_rect = p->white_keys[i]->scroll_rects.scrollRects[j].rect;
-            source_rect = CLITERAL(Rectangle)
-            {
-                .x = current_rect.x + source_offset_x,
-                .y = current_rect.y + source_offset_y,
-                .width = current_rect.width,
-                .height = current_rect.height
-            };
-            DrawTexturePro(perlin_texture, source_rect, current_rect, CLITERAL(Vector2)
-            { 0, 0 }, 0.f, WHITE);
-            DrawRectangleRoundedLines(current_rect, 0.5f, 5, 2, WHITE);
-        }
+void append_rect(Rects *arr, Rectangle rect) {
+    if (arr->size == arr->capacity) {
+        arr->capacity = arr->capacity == 0 ? 256 : arr->capacity * 2;
+        arr->items = realloc(arr->items, arr->capacity * sizeof(Rectangle));
+        assert(arr->items != NULL && "Buy more RAM lol");
     }
-    EndShaderMode();
+    arr->items[arr->size++] = rect;
+}
 
-    BeginShaderMode(p->bk_shader);
-    for (size_t i = 0; i < N_BLACK_KEYS; i++) {
-        for (size_t j = 0; j < p->black_keys[i]->scroll_rects.size; j++) {
-            current_rect = p->black_keys[i]->scroll_rects.scrollRects[j].rect;
-            source_rect = CLITERAL(Rectangle)
-            {
-                current_rect.x + source_offset_x, current_rect.y +
-                                                  source_offset_y, current_rect.width, current_rect.height
-            };
-            DrawTexturePro(perlin_texture, source_rect, current_rect, CLITERAL(Vector2)
-            { 0, 0 }, 0.f, WHITE);
-        }
+// Puts the fills of all rects into one quad batch.
+// The shaders compute the noise from the fragment position, so the default texture is enough.
+void batch_rect_fills(const Rects *rects) {
+    rlSetTexture(rlGetTextureIdDefault());
+    rlBegin(RL_QUADS);
+    rlColor4ub(255, 255, 255, 255);
+    rlNormal3f(0.f, 0.f, 1.f);
+    for (size_t i = 0; i < rects->size; i++) {
+        Rectangle r = rects->items[i];
+
+        reserve_batch_vertices(4);
+        rlTexCoord2f(0.f, 0.f);
+        rlVertex2f(r.x, r.y);
+        rlTexCoord2f(0.f, 1.f);
+        rlVertex2f(r.x, r.y + r.height);
+        rlTexCoord2f(1.f, 1.f);
+        rlVertex2f(r.x + r.width, r.y + r.height);
+        rlTexCoord2f(1.f, 0.f);
+        rlVertex2f(r.x + r.width, r.y);
     }
-    EndShaderMode();
+    rlEnd();
+    rlSetTexture(0);
+}
 
-    // For some reason the color of DrawRectangleRoundedLines is always white in the shader, so I have to render the black ones separately
-    for (size_t i = 0; i < N_BLACK_KEYS; i++) {
-        for (size_t j = 0; j < p->black_keys[i]->scroll_rects.size; j++) {
-            current_rect = p->black_keys[i]->scroll_rects.scrollRects[j].rect;
-            DrawRectangleRoundedLines(current_rect, 0.5f, 5, 2, BLACK);
-        }
+// All outlines use the shapes texture, so consecutive calls stay in the same rlgl draw
+void batch_rect_outlines(const Rects *rects, Color color) {
+    for (size_t i = 0; i < rects->size; i++) {
+        reserve_batch_vertices(SCROLL_RECT_OUTLINE_VERTICES);
+        DrawRectangleRoundedLines(rects->items[i], SCROLL_RECT_ROUNDNESS, SCROLL_RECT_SEGMENTS,
+                                  SCROLL_RECT_LINE_THICK, color);
     }
 }
 
-void update_scroll_rects() {
-    float dt = GetFrameTime();
-    float offset = SCROLL_SPEED * dt;
-    size_t n_scroll_rects = 0;
-    ScrollRect *current_rects = NULL;
+// A rect rises from its key at SCROLL_SPEED from its start, and its bottom leaves the key at its end
+void collect_scroll_rects(void) {
+    const Keyboard *kb = &p->keyboard;
+    double now = p->sim.now;
+    float base = kb->top - KEY_SCROLL_RECT_OFFSET;
 
     for (size_t i = 0; i < N_KEYS; i++) {
-        n_scroll_rects = p->keys[i].scroll_rects.size;
-        current_rects = p->keys[i].scroll_rects.scrollRects;
-        if (!p->keys[i].pressed) {
-            if (n_scroll_rects > 0) {
-                current_rects[n_scroll_rects - 1].finished = true;
-            }
-        } else {
-            current_rects[n_scroll_rects - 1].rect.height += offset;
+        ScrollRects *rects = &p->scroll_rects[i];
+        Rects *visible = kb->white[i] ? &p->visible_white_rects : &p->visible_black_rects;
+        for (size_t j = 0; j < rects->size; j++) {
+            ScrollRect *sr = scroll_rect_at(rects, j);
+            float top = base - (float) ((now - sr->start) * SCROLL_SPEED);
+            float bottom = sr->finished ? base - (float) ((now - sr->end) * SCROLL_SPEED) : base;
+            float height = fmaxf(bottom - top, 1.f);
+            if (bottom < 0.f) continue;
+            append_rect(visible, (Rectangle) { kb->x[i], bottom - height, kb->width[i], height });
         }
+    }
+}
+
+// Where notes of the index end up on screen at a given time
+typedef struct {
+    float now;
+    float keyboard_top;
+    double clock;           // Simulation.now at now, for rebuilt scroll rects
+} NoteView;
+
+void collect_falling_note(const Note *note, void *user_data) {
+    const NoteView *view = user_data;
+    if (note->key < 21 || note->key >= 21 + N_KEYS) return;
+
+    const Keyboard *kb = &p->keyboard;
+    size_t key = note->key - 21;
+    float bottom = view->keyboard_top - (note->start - view->now) * SCROLL_SPEED;
+    float top = view->keyboard_top - (note->end - view->now) * SCROLL_SPEED;
+    // notes that are already sounding disappear into the keys, long ones reach past the top of the window
+    if (bottom > view->keyboard_top) bottom = view->keyboard_top;
+    if (top < 0.f) top = 0.f;
+
+    Rectangle rect = { kb->x[key], top, kb->width[key], bottom - top };
+    append_rect(kb->white[key] ? &p->visible_white_rects : &p->visible_black_rects, rect);
+}
 
-        for (size_t j = 0; j < n_scroll_rects; j++) {
-            current_rects[j].rect.y -= offset;
+// Notes that will sound within the next screen height fall towards the keys and hit them when they start
+void collect_falling_notes(void) {
+    if (!p->new_piece_loaded || p->note_index.n_notes == 0) return;
 
-            if (current_rects[j].finished) {
-                if (current_rects[j].rect.y + current_rects[j].rect.height < 0) {
-                    delete_scroll_rect(&p->keys[i].scroll_rects, j);
-                }
-            }
-        }
+    // the player's tick is where the audio is rendered, what is heard is the A/V offset behind
+    float heard = p->offline_audio.active ? 0.f : (float) fmax(p->av_offset, 0.0);
+    NoteView view = {
+        .now = (float) note_index_tick_to_seconds(&p->note_index, p->playback.tick) - heard,
+        .keyboard_top = p->keyboard.top - KEY_SCROLL_RECT_OFFSET,
+    };
+    float window = view.keyboard_top / SCROLL_SPEED;
+    note_index_query(&p->note_index, view.now, view.now + window, collect_falling_note, &view);
+}
+
+void clear_scroll_rects(void) {
+    for (size_t i = 0; i < N_KEYS; i++) {
+        p->scroll_rects[i].head = 0;
+        p->scroll_rects[i].size = 0;
+    }
+}
+
+// Rebuilds the rect a note would have left behind if the piece had been played up to view->now
+void restore_scroll_rect(const Note *note, void *user_data) {
+    const NoteView *view = user_data;
+    if (note->key < 21 || note->key >= 21 + N_KEYS) return;
+
+    size_t key = note->key - 21;
+    bool sounding = note->end > view->now;
+    ScrollRect sr = {
+        .start = view->clock - (view->now - note->start),
+        .end = view->clock - (view->now - note->end),
+        .finished = !sounding,
+    };
+
+    // only the newest rect of a key may keep growing, an overlapping older note ends where this one starts
+    ScrollRect *previous = last_scroll_rect(&p->scroll_rects[key]);
+    if (previous != NULL && !previous->finished) {
+        previous->end = sr.start;
+        previous->finished = true;
+    }
+    append_scroll_rect(&p->scroll_rects[key], sr);
+    if (sounding) p->keyboard.pressed[key] = true;
+}
+
+void collect_held_note(const Note *note, void *user_data) {
+    float now = *(const float *) user_data;
+    PlaybackShared *shared = &p->playback_shared;
+    // notes starting right at the seek target are still played by the player itself
+    if (note->start < now && note->end > now && shared->n_held_notes < HELD_NOTES_CAP) {
+        shared->held_notes[shared->n_held_notes++] = (HeldNote) {
+            .channel = note->channel, .key = note->key, .velocity = note->velocity
+        };
     }
 }
 
+// Jumps to tick with the keys held at that point pressed, the rects of the last screen height
+// rebuilt and the held notes sounding again, all from the note index in O(log n + k)
+void seek_to_tick(int tick) {
+    if (p->fs_player == NULL) return;
+
+    lock_simulation();
+    reset_keys();
+    clear_scroll_rects();
+    disarm_seek();
+    if (p->note_index.n_notes > 0) {
+        NoteView view = {
+            .now = (float) note_index_tick_to_seconds(&p->note_index, tick),
+            .keyboard_top = p->keyboard.top - KEY_SCROLL_RECT_OFFSET,
+            .clock = p->sim.now,
+        };
+        float window = view.keyboard_top / SCROLL_SPEED;
+        note_index_query(&p->note_index, view.now - window, view.now, restore_scroll_rect, &view);
+        // the player thread starts these once the seek lands, see player_tick_callback
+        p->playback_shared.n_held_notes = 0;
+        note_index_query(&p->note_index, view.now, view.now, collect_held_note, &view.now);
+        atomic_store_explicit(&p->playback_shared.seek_from, p->playback.tick > 0 ? p->playback.tick : 0,
+                              memory_order_relaxed);
+        atomic_store_explicit(&p->playback_shared.seek_tick, tick, memory_order_release);
+    }
+    unlock_simulation();
+
+    fluid_player_seek(p->fs_player, tick);
+    p->playback.tick = tick;
+    p->last_seek_tick = tick;
+}
+
+// Uniforms of the frame, between the last two ticks of the animation
+void update_noise_shaders(void) {
+    const NoiseAnimation *prev = &p->sim.prev_noise;
+    const NoiseAnimation *noise = &p->sim.noise;
+    float alpha = p->sim.alpha;
+    float wk_threshold = prev->wk_threshold + (noise->wk_threshold - prev->wk_threshold) * alpha;
+    float bk_threshold = prev->bk_threshold + (noise->bk_threshold - prev->bk_threshold) * alpha;
+    // the time only ever moves forward by one tick, also across the wrap
+    float time = fmodf(prev->time + SIM_DT * alpha, 2.f * PI);
+
+    SetShaderValue(p->wk_shader, wk_perlin_threshold_loc, &wk_threshold, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(p->bk_shader, bk_perlin_threshold_loc, &bk_threshold, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(p->wk_shader, wk_perlin_time_loc, &time, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(p->bk_shader, bk_perlin_time_loc, &time, SHADER_UNIFORM_FLOAT);
+}
+
+// What render_scroll_rects draws: either the rising scroll rects or the falling notes of the piece
+void collect_visible_rects(void) {
+    p->visible_white_rects.size = 0;
+    p->visible_black_rects.size = 0;
+    if (p->falling_notes) {
+        collect_falling_notes();
+    } else {
+        collect_scroll_rects();
+    }
+    p->render_stats.live_rects = p->visible_white_rects.size + p->visible_black_rects.size;
+}
+
+// Draws what collect_visible_rects gathered with the uniforms of update_noise_shaders, without touching the simulation
+void render_scroll_rects() {
+    Rects *white = &p->visible_white_rects;
+    Rects *black = &p->visible_black_rects;
+
+    // Whatever was drawn before (the keys) must not end up in the counted batches
+    rlDrawRenderBatchActive();
+
+    // Passes keep the old painting order: white fills, white outlines, black fills, black outlines
+    BeginShaderMode(p->wk_shader);
+    batch_rect_fills(white);
+    flush_batch(white->size);
+    EndShaderMode();
+
+    // Outlines are plain white/black, they never needed the noise shaders
+    batch_rect_outlines(white, WHITE);
+    flush_batch(white->size);
+
+    BeginShaderMode(p->bk_shader);
+    batch_rect_fills(black);
+    flush_batch(black->size);
+    EndShaderMode();
+
+    batch_rect_outlines(black, BLACK);
+    flush_batch(black->size);
+}
+
 void render_timeline(void) {
     DrawRectangleRec(p->ui.timeline.bounds, RED);
     DrawRectangleRec(p->ui.timeline.slider.bounds, WHITE);
 
     if (p->new_piece_loaded) {
-        float progress = (float) fluid_player_get_current_tick(p->fs_player) / (float) p->current_piece.total_ticks;
+        float progress = (float) p->playback.tick / (float) p->current_piece.total_ticks;
         Vector2 progress_start =
                 {
                     .x = p->ui.timeline.slider.bounds.x,
@@ -668,9 +2941,8 @@ void update_ui(void) {
             if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
                 float pos_normal = (mouse_position.x - p->ui.timeline.slider.bounds.x) / p->ui.timeline.slider.bounds.width;
                 int ticks = (int)(pos_normal * (float)p->current_piece.total_ticks);
-                reset_keys();
-                fluid_synth_all_notes_off(p->fs_synth, -1);
-                fluid_player_seek(p->fs_player, ticks);
+                // holding the mouse still on the timeline should not restart the notes every frame
+                if (ticks != p->last_seek_tick) seek_to_tick(ticks);
             }
         } else {
             p->ui.timeline.slider.hovered = false;
@@ -678,64 +2950,63 @@ void update_ui(void) {
     }
 }
 
+// Several midi files, or playlist files, dropped together play one after another in the order they came
 void handle_dropped_file(void) {
     FilePathList dropped_files = LoadDroppedFiles();
 
-    const char *file0 = dropped_files.paths[0];
-    if (fluid_is_midifile(file0)) {
-        if (p->fs_player != NULL) {
-            fluid_player_stop(p->fs_player);
-            delete_fluid_player(p->fs_player);
-            fluid_synth_all_notes_off(p->fs_synth, -1);
-            reset_keys();
+    Playlist playlist = {0};
+    collect_playlist(&playlist, (const char *const *) dropped_files.paths, dropped_files.count);
+    for (unsigned int i = 0; i < dropped_files.count; i++) {
+        const char *file = dropped_files.paths[i];
+        if (fluid_is_soundfont(file) && strcmp(".sf2", GetFileExtension(file)) == 0) {
+            start_soundfont_load(file);
+        } else if (!fluid_is_midifile(file) && !is_playlist_file(file)) {
+            TraceLog(LOG_INFO, "MIDI: Unupported file fropped: %s", file);
         }
+    }
 
-        p->fs_player = new_fluid_player(p->fs_synth);
-        assert(p->fs_player != NULL && "Failed to make new Fluid player");
-        fluid_player_set_playback_callback(p->fs_player, player_midi_callback, NULL);
-        fluid_player_set_tick_callback(p->fs_player, player_tick_callback, NULL);
-        fluid_player_add(p->fs_player, file0);
-
-        fluid_player_set_loop(p->fs_player, -1);
-        fluid_player_play(p->fs_player);
-
-        p->current_piece.file_path = strdup(file0);
-
-        p->new_piece_loaded = false;
-        TraceLog(LOG_INFO, "MIDI: Midi file loaded: %s Press P to play/pause", file0);
-
-    } else if (fluid_is_soundfont(file0) && strcmp(".sf2", GetFileExtension(file0)) == 0) {
-        p->sound_font_id = fluid_synth_sfload(p->fs_synth, file0, 1);
-        TraceLog(LOG_INFO, "Sound Font ID: %d", p->sound_font_id);
-        if (p->sound_font_id == FLUID_FAILED) {
-            TraceLog(LOG_ERROR, "FLUIDSYNTH: failed to load soundfont [%s]", file0);
-        } else {
-            TraceLog(LOG_INFO, "FLUIDSYNTH: Loaded sound font file [%s]", file0);
-        }
-    } else {
-        TraceLog(LOG_INFO, "MIDI: Unupported file fropped: %s", file0);
+    if (playlist.size > 0 && p->stress.active) {
+        // the generator is the only producer of the note ring while it runs
+        TraceLog(LOG_INFO, "MIDI: ignoring %zu midi files during the stress test", playlist.size);
+        free_playlist(&playlist);
+    } else if (playlist.size > 0) {
+        play_playlist(&playlist);
     }
     UnloadDroppedFiles(dropped_files);
 }
 
 void handle_user_input(void) {
-    if (IsKeyPressed(KEY_P)) {
-        int fp_status = fluid_player_get_status(p->fs_player);
+    if (IsKeyPressed(KEY_P) && p->fs_player != NULL) {
+        int fp_status = p->playback.status;
         if (fp_status == FLUID_PLAYER_PLAYING) {
+            // a seek that has not landed yet would start the notes of its target when playback resumes elsewhere
+            disarm_seek();
             fluid_player_stop(p->fs_player);
         } else if (fp_status == FLUID_PLAYER_DONE) {
             fluid_player_play(p->fs_player);
         }
+        lock_simulation();
         reset_keys();
+        unlock_simulation();
     }
-    if (IsKeyPressed(KEY_Q)) {
-        fluid_player_seek(p->fs_player, 0);
-        reset_keys();
+    if (IsKeyPressed(KEY_Q) && p->fs_player != NULL) {
+        seek_to_tick(0);
     }
-    if (IsKeyPressed(KEY_H)) {
-        int total_ticks = fluid_player_get_total_ticks(p->fs_player);
-        fluid_player_seek(p->fs_player, total_ticks / 2);
-        reset_keys();
+    if ((IsKeyPressed(KEY_LEFT_BRACKET) || IsKeyPressed(KEY_RIGHT_BRACKET)) && p->fs_audio_driver != NULL) {
+        double step = IsKeyPressed(KEY_RIGHT_BRACKET) ? AV_OFFSET_STEP : -AV_OFFSET_STEP;
+        p->av_offset = fmin(fmax(p->av_offset + step, 0.0), AV_OFFSET_MAX);
+        atomic_store_explicit(&p->audio_shared.av_offset_usec, (int) (p->av_offset * 1e6), memory_order_relaxed);
+        TraceLog(LOG_INFO, "AUDIO: visuals wait %.1f ms for the audio", p->av_offset * 1000.0);
+    }
+    if (IsKeyPressed(KEY_F3)) {
+        p->show_profiler = !p->show_profiler;
+    }
+    if (IsKeyPressed(KEY_F)) {
+        p->falling_notes = !p->falling_notes;
+        TraceLog(LOG_INFO, "VISUALS: %s", p->falling_notes ? "falling notes" : "scroll rects");
+    }
+    if (IsKeyPressed(KEY_H) && p->new_piece_loaded) {
+        seek_to_tick(p->current_piece.total_ticks / 2);
     }
 
     if (IsFileDropped()) {
@@ -744,23 +3015,166 @@ void handle_user_input(void) {
 
     if (IsWindowResized()) {
         init_ui();
-        calculate_key_rects();
+        lock_simulation();
+        layout_keyboard();
+        unlock_simulation();
+    }
+}
+
+// Next to DrawFPS: the slowest audio block of the last interval against the length of a block
+void render_audio_health(void) {
+    AudioHealth *health = &p->audio_health;
+    if (p->fs_audio_driver == NULL) return;
+
+    bool trouble = health->interval_late_blocks > 0 || health->interval_xruns > 0;
+    DrawText(TextFormat("audio %.2f/%.2f ms, cpu %.0f%%, %d voices, %lld xruns, a/v %.0f ms", health->render_ms_max,
+                        health->period_ms, health->cpu_load, health->voices, health->xruns, p->av_offset * 1000.0),
+             110, 10, 20, trouble ? RED : LIME);
+}
+
+// Where the No SoundFont hint goes, the part of the file read so far
+void render_soundfont_load(void) {
+    SoundFontLoad *load = &p->sfont_load;
+    long long bytes_read = atomic_load_explicit(&load->bytes_read, memory_order_relaxed);
+    float progress = load->file_size > 0 ? fminf((float) bytes_read / (float) load->file_size, 1.f) : 0.f;
+
+    DrawTextEx(p->font, TextFormat("Loading %s: %.0f%%", GetFileName(load->file_path), progress * 100.f),
+               CLITERAL(Vector2) { 50, 50 }, 20, 0, BLACK);
+    DrawRectangle(50, 75, 300, 8, Fade(BLACK, 0.3f));
+    DrawRectangle(50, 75, (int) (300.f * progress), 8, BLACK);
+}
+
+void render_profiler_overlay(void) {
+    const int font_size = 10;
+    const int line_height = 12;
+    const int x = 10;
+    int y = 50;
+    double now = GetTime();
+
+    DrawRectangle(x - 5, y - 5, 430, (PROFILE_PHASE_COUNT + 5) * line_height + 10, Fade(BLACK, 0.7f));
+    DrawText(TextFormat("last %.0fs, ms", PROFILER_WINDOW), x, y, font_size, RAYWHITE);
+    DrawText("last      p50      p95      p99      max", x + 160, y, font_size, RAYWHITE);
+    y += line_height;
+    for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+        PhaseStats stats = profiler_stats(&p->profiler, phase, now);
+        DrawText(profiler_phase_name(phase), x, y, font_size, phase == PROFILE_FRAME ? YELLOW : LIME);
+        DrawText(TextFormat("%6.2f   %6.2f   %6.2f   %6.2f   %6.2f", stats.last * 1000.0, stats.p50 * 1000.0,
+                            stats.p95 * 1000.0, stats.p99 * 1000.0, stats.max * 1000.0),
+                 x + 160, y, font_size, phase == PROFILE_FRAME ? YELLOW : LIME);
+        y += line_height;
     }
+    y += line_height;
+    DrawText(TextFormat("%zu rects, %zu draws, %zu batch flushes", p->render_stats.live_rects,
+                        p->render_stats.draw_calls, p->render_stats.batch_flushes), x, y, font_size, RAYWHITE);
+    y += line_height;
+    DrawText(TextFormat("midi in -> audio p50 %.2f p99 %.2f, -> screen p50 %.2f p99 %.2f ms",
+                        latency_percentile(&p->input_to_audio, 0.5) * 1000.0,
+                        latency_percentile(&p->input_to_audio, 0.99) * 1000.0,
+                        latency_percentile(&p->input_to_frame, 0.5) * 1000.0,
+                        latency_percentile(&p->input_to_frame, 0.99) * 1000.0), x, y, font_size, RAYWHITE);
+}
+
+// True when the last frame is still what the screen should show: no playback, no rects, no queued
+// notes and no input or window change since the last poll
+bool nothing_to_draw(void) {
+    if (p->stress.active || p->playback.status == FLUID_PLAYER_PLAYING) return false;
+    if (atomic_load_explicit(&p->sfont_load.state, memory_order_relaxed) != LOAD_IDLE) return false;
+    if (atomic_load_explicit(&p->midi_load.state, memory_order_relaxed) != LOAD_IDLE) return false;
+    if (p->render_stats.live_rects > 0 || p->n_pointers > 0) return false;
+    for (size_t i = 0; i < N_KEYS; i++) {
+        if (p->keyboard.pressed[i]) return false;
+    }
+    if (!note_ring_empty(&p->note_events) || !note_ring_empty(&p->midi_input_events)) return false;
+
+    Vector2 mouse_delta = GetMouseDelta();
+    if (mouse_delta.x != 0.f || mouse_delta.y != 0.f || GetMouseWheelMove() != 0.f) return false;
+    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) return false;
+    if (GetTouchPointCount() > 0 || IsFileDropped() || IsWindowResized()) return false;
+    // only pops the queue of typed keys, what the presses do was handled by skip_frame right after its poll
+    return GetKeyPressed() == 0;
+}
+
+// Instead of a frame: keep the event rings and the audio stats moving and wait for the next input poll.
+// EndDrawing is what normally polls, so without a frame it has to be done here.
+void skip_frame(void) {
+    // an unattended playlist goes on while the window is minimized
+    finish_midi_load(false);
+    update_playlist();
+    lock_simulation();
+    drain_note_events();
+    unlock_simulation();
+    update_audio_health();
+    WaitTime(IDLE_POLL_INTERVAL);
+    PollInputEvents();
+    // the next frame polls again in EndDrawing before it handles input, which would lose the key
+    // presses and resizes of this poll
+    handle_user_input();
 }
 
 void plug_update(void) {
-    BeginDrawing();
+    bool exporting = p->video_export.active;
+    Profiler *prof = &p->profiler;
+    if (plug_finished()) return;
+
+    if (!exporting) {
+        take_playback_snapshot();
+        // nothing is drawn while minimized, and only IDLE_FPS frames while nothing changes
+        lock_simulation();
+        bool idle = nothing_to_draw() && GetTime() - p->last_frame < 1.0 / IDLE_FPS;
+        unlock_simulation();
+        if (IsWindowMinimized() || idle) {
+            skip_frame();
+            return;
+        }
+        p->last_frame = GetTime();
+    }
+
+    profiler_begin_frame(prof, GetTime());
+    memset(&p->render_stats, 0, sizeof(p->render_stats));
+    if (exporting) advance_export_audio();
+    if (p->stress.active) advance_stress_test();
+    // before the simulation lock, which swapping the piece takes
+    finish_midi_load(false);
+    update_playlist();
+    take_playback_snapshot();
+
+    // from here until the keys are handled the simulation thread waits, after that the frame only
+    // draws what collect_visible_rects copied
+    lock_simulation();
+    // first, so the notes of this frame start at the time it shows
+    advance_simulation();
+    profiler_mark(prof, PROFILE_UPDATE_SCROLL_RECTS, GetTime());
+    drain_note_events();
+    update_audio_health();
+    finish_soundfont_load(false);
+    profiler_mark(prof, PROFILE_EVENTS, GetTime());
+    collect_visible_rects();
+    update_noise_shaders();
+    profiler_mark(prof, PROFILE_RENDER_SCROLL_RECTS, GetTime());
+
+    if (exporting) {
+        BeginTextureMode(p->video_export.target);
+    } else {
+        BeginDrawing();
+    }
     ClearBackground(DARKGRAY);
     render_keys();
-    update_keys();
+    profiler_mark(prof, PROFILE_RENDER_KEYS, GetTime());
+    if (!exporting) update_keys();
+    profiler_mark(prof, PROFILE_UPDATE_KEYS, GetTime());
+    unlock_simulation();
 
     render_scroll_rects();
-    update_scroll_rects();
+    profiler_mark(prof, PROFILE_RENDER_SCROLL_RECTS, GetTime());
 
     render_ui();
-    update_ui();
+    profiler_mark(prof, PROFILE_RENDER_UI, GetTime());
+    if (!exporting) update_ui();
+    profiler_mark(prof, PROFILE_UPDATE_UI, GetTime());
 
-    if (fluid_synth_sfcount(p->fs_synth) == 0) {
+    if (atomic_load_explicit(&p->sfont_load.state, memory_order_relaxed) != LOAD_IDLE) {
+        render_soundfont_load();
+    } else if (fluid_synth_sfcount(p->fs_synth) == 0 && !exporting) {
         DrawTextEx(p->font, "No SoundFont file loaded (.sf2). Drag&Drop one to hear sound", CLITERAL(Vector2)
         { 50, 50 }, 20, 0, BLACK);
     }
@@ -771,7 +3185,7 @@ void plug_update(void) {
         int total_sec = p->current_piece.duration % 60;
 
         int progress_total =
-                (float) fluid_player_get_current_tick(p->fs_player) / (float) p->current_piece.total_ticks *
+                (float) p->playback.tick / (float) p->current_piece.total_ticks *
                 p->current_piece.duration;
         int progress_min = progress_total / 60;
         int progress_sec = progress_total % 60;
@@ -783,7 +3197,29 @@ void plug_update(void) {
                    CLITERAL(Vector2)
         { 50, 100 }, 20, 0, BLACK);
     }
+
+    if (exporting) {
+        EndTextureMode();
+        profiler_mark(prof, PROFILE_TEXT, GetTime());
+        finish_export_frame();
+        // nothing is shown, but the hidden window still has to process its events
+        BeginDrawing();
+        EndDrawing();
+        profiler_mark(prof, PROFILE_END_DRAWING, GetTime());
+        profiler_end_frame(prof, GetTime());
+        return;
+    }
+
     DrawFPS(10, 10);
+    render_audio_health();
+    if (p->show_profiler) render_profiler_overlay();
+    profiler_mark(prof, PROFILE_TEXT, GetTime());
+    // includes the buffer swap and the wait for the target frame rate
     EndDrawing();
+    profiler_mark(prof, PROFILE_END_DRAWING, GetTime());
+    record_input_frame_latency();
     handle_user_input();
+    profiler_mark(prof, PROFILE_INPUT, GetTime());
+    profiler_end_frame(prof, GetTime());
+    if (p->stress.active) record_stress_frame();
 }
\ No newline at end of file
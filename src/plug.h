@@ -1,14 +1,46 @@
 #ifndef PLUG_H_
 #define PLUG_H_
 
+#include <stdbool.h>
+
+// Filled from the command line in main.c, the strings have to outlive the plug
+typedef struct {
+    const char *midi_path;          // played right away instead of waiting for a drop
+    const char *soundfont_path;
+    const char *video_path;         // when set: render the midi offline into this file ("-" for stdout) and quit
+    const char *audio_path;         // when set: render the audio offline into this .wav/.flac file and quit
+    const char *events_path;        // with an export: CSV of every note event in the rendered sample clock
+    const char *midi_input_replay;  // plays this file as if it came from a MIDI device, to test the input path
+    bool midi_input;                // listen to MIDI devices through fluidsynth's midi driver (midi.driver)
+    const char *stress_spec;        // when set: play generated notes instead of a midi file, see stress_parse_spec
+    const char *stress_results_path;// CSV of frame times, live rects and synth load of every frame of the stress run
+    const char *av_offset;          // milliseconds the visuals wait for the audio, "auto" (the driver buffers) when NULL
+    const char *latency_profile;    // ultra-low, balanced or safe, fluidsynth's defaults when NULL
+    const char *config_path;        // fluidsynth settings as "name = value" lines, applied over the profile
+    const char *audio_driver;       // these override the profile and the config file, NULL/0 when not given
+    int period_size;
+    int periods;
+    double sample_rate;
+    int soundfont_budget_mb;        // unused soundfonts are kept for a re-drop while their files fit, 0 unloads them
+    bool dynamic_samples;           // keep only the samples of the presets in use in memory
+    int cpu_cores;                  // synth.cpu-cores, threads that render voices, 0 keeps fluidsynth's default of 1
+    int benchmark_cores;            // when set: render midi_path offline with 1..benchmark_cores cores, report and quit
+    int fps;                        // frame rate of the exported video
+    bool sim_thread;                // run the fixed step simulation on its own thread instead of in the frame
+    bool falling_notes;             // start with upcoming notes falling onto the keys
+} PlugOptions;
+
 #define LIST_OF_PLUGS \
-    PLUG(plug_init, void, void) \
+    PLUG(plug_init, void, const PlugOptions*) \
     PLUG(plug_pre_reload, void*, void) \
     PLUG(plug_post_reload, void, void*) \
     PLUG(plug_update, void, void)      \
+    PLUG(plug_finished, bool, void)    \
+    PLUG(plug_export_audio, bool, const PlugOptions*) \
+    PLUG(plug_benchmark, bool, const PlugOptions*) \
     PLUG(plug_clean, void, void)
 #define PLUG(name, ret, ...) typedef ret (name##_t)(__VA_ARGS__);
 LIST_OF_PLUGS
 #undef PLUG
 
-#endif // PLUG_H_
\ No newline at end of file
+#endif // PLUG_H_
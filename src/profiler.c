@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "profiler.h"
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {
+#define PHASE(id, name) [id] = name,
+    LIST_OF_PROFILE_PHASES
+#undef PHASE
+};
+
+const char *profiler_phase_name(ProfilePhase phase) {
+    return phase_names[phase];
+}
+
+void profiler_begin_frame(Profiler *profiler, double now) {
+    size_t slot = profiler->head;
+    profiler->frame_start[slot] = now;
+    for (size_t i = 0; i < PROFILE_PHASE_COUNT; i++) profiler->durations[i][slot] = 0.f;
+    profiler->last_mark = now;
+}
+
+void profiler_mark(Profiler *profiler, ProfilePhase phase, double now) {
+    profiler->durations[phase][profiler->head] += (float) (now - profiler->last_mark);
+    profiler->last_mark = now;
+}
+
+void profiler_end_frame(Profiler *profiler, double now) {
+    size_t slot = profiler->head;
+    profiler->durations[PROFILE_FRAME][slot] = (float) (now - profiler->frame_start[slot]);
+    profiler->head = (slot + 1) % PROFILER_HISTORY;
+    if (profiler->count < PROFILER_HISTORY) profiler->count++;
+}
+
+double profiler_last(const Profiler *profiler, ProfilePhase phase) {
+    if (profiler->count == 0) return 0.0;
+    return profiler->durations[phase][(profiler->head + PROFILER_HISTORY - 1) % PROFILER_HISTORY];
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float fa = *(const float *) a;
+    float fb = *(const float *) b;
+    return (fa > fb) - (fa < fb);
+}
+
+PhaseStats profiler_stats(const Profiler *profiler, ProfilePhase phase, double now) {
+    static float window[PROFILER_HISTORY];
+    PhaseStats stats = {0};
+    size_t n = 0;
+
+    // walk back from the newest finished frame until the window is covered
+    for (size_t i = 1; i <= profiler->count; i++) {
+        size_t slot = (profiler->head + PROFILER_HISTORY - i) % PROFILER_HISTORY;
+        if (now - profiler->frame_start[slot] > PROFILER_WINDOW) break;
+        window[n++] = profiler->durations[phase][slot];
+    }
+    if (n == 0) return stats;
+
+    stats.last = window[0];
+    qsort(window, n, sizeof(window[0]), compare_floats);
+    stats.p50 = window[(n - 1) * 50 / 100];
+    stats.p95 = window[(n - 1) * 95 / 100];
+    stats.p99 = window[(n - 1) * 99 / 100];
+    stats.max = window[n - 1];
+    return stats;
+}
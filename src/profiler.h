@@ -0,0 +1,60 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stddef.h>
+
+#define PROFILER_HISTORY 2048           // frames, must cover PROFILER_WINDOW at the highest frame rate
+#define PROFILER_WINDOW 5.0             // seconds the percentiles are taken over
+
+#define LIST_OF_PROFILE_PHASES \
+    PHASE(PROFILE_EVENTS, "events") \
+    PHASE(PROFILE_RENDER_KEYS, "render_keys") \
+    PHASE(PROFILE_UPDATE_KEYS, "update_keys") \
+    PHASE(PROFILE_RENDER_SCROLL_RECTS, "render_scroll_rects") \
+    PHASE(PROFILE_UPDATE_SCROLL_RECTS, "update_scroll_rects") \
+    PHASE(PROFILE_RENDER_UI, "render_ui") \
+    PHASE(PROFILE_UPDATE_UI, "update_ui") \
+    PHASE(PROFILE_TEXT, "text") \
+    PHASE(PROFILE_END_DRAWING, "EndDrawing") \
+    PHASE(PROFILE_INPUT, "input") \
+    PHASE(PROFILE_FRAME, "frame")
+
+typedef enum {
+#define PHASE(id, name) id,
+    LIST_OF_PROFILE_PHASES
+#undef PHASE
+    PROFILE_PHASE_COUNT
+} ProfilePhase;
+
+typedef struct {
+    double p50;
+    double p95;
+    double p99;
+    double max;
+    double last;
+} PhaseStats;
+
+// Durations of the phases of the last PROFILER_HISTORY frames, all times in seconds
+typedef struct {
+    double frame_start[PROFILER_HISTORY];
+    float durations[PROFILE_PHASE_COUNT][PROFILER_HISTORY];
+    size_t head;                        // slot of the frame being measured
+    size_t count;
+    double last_mark;
+} Profiler;
+
+const char *profiler_phase_name(ProfilePhase phase);
+
+void profiler_begin_frame(Profiler *profiler, double now);
+// Accounts everything since the previous mark (or the frame start) to phase
+void profiler_mark(Profiler *profiler, ProfilePhase phase, double now);
+// Closes the frame, its PROFILE_FRAME duration is the time since profiler_begin_frame
+void profiler_end_frame(Profiler *profiler, double now);
+
+// Duration of phase in the last finished frame
+double profiler_last(const Profiler *profiler, ProfilePhase phase);
+
+// Percentiles of the frames that started within PROFILER_WINDOW before now
+PhaseStats profiler_stats(const Profiler *profiler, ProfilePhase phase, double now);
+
+#endif // PROFILER_H_
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stress.h"
+
+#define STRESS_LOWEST_KEY 21
+#define STRESS_HIGHEST_KEY 108
+
+bool stress_parse_spec(StressOptions *options, const char *spec) {
+    *options = (StressOptions) {
+        .notes_per_second = 50.0,
+        .ramp = 0.0,
+        .chord = 1,
+        .low_key = STRESS_LOWEST_KEY,
+        .high_key = STRESS_HIGHEST_KEY,
+        .note_length = 0.25,
+        .trill_key = 0,
+        .duration = 60.0,
+        .seed = 1,
+    };
+
+    // "default" or an empty spec keeps the defaults
+    const char *cursor = spec;
+    while (*cursor != '\0' && strcmp(cursor, "default") != 0) {
+        char key[16];
+        char value[32];
+        int consumed = 0;
+        if (sscanf(cursor, "%15[^=,]=%31[^,]%n", key, value, &consumed) != 2) return false;
+        cursor += consumed;
+        if (*cursor == ',') cursor++;
+
+        if (strcmp(key, "nps") == 0) {
+            options->notes_per_second = atof(value);
+        } else if (strcmp(key, "ramp") == 0) {
+            options->ramp = atof(value);
+        } else if (strcmp(key, "chord") == 0) {
+            options->chord = atoi(value);
+        } else if (strcmp(key, "keys") == 0) {
+            if (sscanf(value, "%d-%d", &options->low_key, &options->high_key) != 2) return false;
+        } else if (strcmp(key, "length") == 0) {
+            options->note_length = atof(value);
+        } else if (strcmp(key, "trill") == 0) {
+            options->trill_key = atoi(value);
+        } else if (strcmp(key, "duration") == 0) {
+            options->duration = atof(value);
+        } else if (strcmp(key, "seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, NULL, 10);
+        } else {
+            return false;
+        }
+    }
+
+    return options->notes_per_second > 0.0 && options->ramp >= 0.0 && options->chord > 0 &&
+           options->low_key >= STRESS_LOWEST_KEY && options->high_key <= STRESS_HIGHEST_KEY &&
+           options->low_key <= options->high_key && options->note_length > 0.0 && options->duration > 0.0 &&
+           (options->trill_key == 0 ||
+            (options->trill_key >= STRESS_LOWEST_KEY && options->trill_key <= STRESS_HIGHEST_KEY));
+}
+
+void stress_init(StressGenerator *gen, const StressOptions *options) {
+    memset(gen, 0, sizeof(*gen));
+    gen->options = *options;
+    gen->rng = options->seed != 0 ? options->seed : 1;
+}
+
+void stress_free(StressGenerator *gen) {
+    free(gen->offs);
+    memset(gen, 0, sizeof(*gen));
+}
+
+// xorshift32, the same seed always plays the same notes
+static uint32_t next_random(StressGenerator *gen) {
+    uint32_t x = gen->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    gen->rng = x;
+    return x;
+}
+
+static int random_between(StressGenerator *gen, int low, int high) {
+    return low + (int) (next_random(gen) % (uint32_t) (high - low + 1));
+}
+
+static bool push_note_off(StressGenerator *gen, PendingNoteOff off) {
+    // reuse the space of the offs that were already emitted before growing
+    if (gen->offs_head > 0 && gen->offs_head + gen->offs_size == gen->offs_capacity) {
+        memmove(gen->offs, gen->offs + gen->offs_head, gen->offs_size * sizeof(*gen->offs));
+        gen->offs_head = 0;
+    }
+    if (gen->offs_head + gen->offs_size == gen->offs_capacity) {
+        size_t capacity = gen->offs_capacity == 0 ? 256 : gen->offs_capacity * 2;
+        PendingNoteOff *offs = realloc(gen->offs, capacity * sizeof(*offs));
+        if (offs == NULL) return false;
+        gen->offs = offs;
+        gen->offs_capacity = capacity;
+    }
+    gen->offs[gen->offs_head + gen->offs_size] = off;
+    gen->offs_size++;
+    return true;
+}
+
+static void emit_note_offs(StressGenerator *gen, double until, StressEmit emit, void *user_data) {
+    while (gen->offs_size > 0 && gen->offs[gen->offs_head].time <= until) {
+        emit(false, gen->offs[gen->offs_head].key, 0, user_data);
+        gen->offs_head++;
+        gen->offs_size--;
+    }
+    if (gen->offs_size == 0) gen->offs_head = 0;
+}
+
+double stress_notes_per_second(const StressGenerator *gen, double t) {
+    return gen->options.notes_per_second + gen->options.ramp * t;
+}
+
+void stress_advance(StressGenerator *gen, double t, StressEmit emit, void *user_data) {
+    const StressOptions *opt = &gen->options;
+
+    while (gen->next_onset <= t && gen->next_onset < opt->duration) {
+        double onset = gen->next_onset;
+        emit_note_offs(gen, onset, emit, user_data);
+
+        for (int i = 0; i < opt->chord; i++) {
+            int key = opt->trill_key != 0 ? opt->trill_key : random_between(gen, opt->low_key, opt->high_key);
+            int velocity = random_between(gen, 40, 120);
+            // without room for the note off the key would hang, so the note is not played at all
+            if (!push_note_off(gen, (PendingNoteOff) {onset + opt->note_length, (uint8_t) key})) break;
+            emit(true, key, velocity, user_data);
+            gen->notes++;
+        }
+        gen->next_onset += opt->chord / stress_notes_per_second(gen, onset);
+    }
+    emit_note_offs(gen, t, emit, user_data);
+}
+
+bool stress_done(const StressGenerator *gen, double t) {
+    return t >= gen->options.duration && gen->offs_size == 0;
+}
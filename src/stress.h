@@ -0,0 +1,52 @@
+#ifndef STRESS_H_
+#define STRESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// What the generator plays, parsed from "key=value,..." (see stress_parse_spec)
+typedef struct {
+    double notes_per_second;        // at the start of the run
+    double ramp;                    // notes per second added every second, to find the ceiling in one run
+    int chord;                      // notes struck together, the onsets per second are notes_per_second / chord
+    int low_key;                    // range of midi keys the notes are picked from
+    int high_key;
+    double note_length;             // seconds
+    int trill_key;                  // when set, every note hits this one key
+    double duration;                // seconds until the run ends
+    uint32_t seed;
+} StressOptions;
+
+typedef struct {
+    double time;
+    uint8_t key;
+} PendingNoteOff;
+
+typedef struct {
+    StressOptions options;
+    double next_onset;
+    uint32_t rng;
+    size_t notes;
+
+    // note offs in time order, every note lasts the same
+    PendingNoteOff *offs;
+    size_t offs_head;
+    size_t offs_size;
+    size_t offs_capacity;
+} StressGenerator;
+
+typedef void (*StressEmit)(bool on, int key, int velocity, void *user_data);
+
+// Fills options with the defaults and then applies spec, false on unknown keys or values out of range
+bool stress_parse_spec(StressOptions *options, const char *spec);
+
+void stress_init(StressGenerator *gen, const StressOptions *options);
+void stress_free(StressGenerator *gen);
+
+// Emits every note on and off due until t seconds after the start of the run, in time order
+void stress_advance(StressGenerator *gen, double t, StressEmit emit, void *user_data);
+double stress_notes_per_second(const StressGenerator *gen, double t);
+bool stress_done(const StressGenerator *gen, double t);
+
+#endif // STRESS_H_
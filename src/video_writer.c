@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "video_writer.h"
+
+struct VideoWriter {
+    FILE *file;
+    VideoFormat format;
+    int width;
+    int height;
+    unsigned char *planes;      // Y, U and V planes of one frame for the Y4M format
+};
+
+static bool has_extension(const char *path, const char *ext) {
+    size_t path_len = strlen(path);
+    size_t ext_len = strlen(ext);
+    return path_len >= ext_len && strcmp(path + path_len - ext_len, ext) == 0;
+}
+
+VideoWriter *video_writer_open(const char *path, int width, int height, int fps) {
+    VideoWriter *writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) return NULL;
+
+    writer->width = width;
+    writer->height = height;
+    if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        writer->file = stdout;
+        writer->format = VIDEO_FORMAT_Y4M;
+    } else {
+        writer->file = fopen(path, "wb");
+        writer->format = has_extension(path, ".y4m") ? VIDEO_FORMAT_Y4M : VIDEO_FORMAT_RGBA;
+    }
+    if (writer->file == NULL) {
+        free(writer);
+        return NULL;
+    }
+
+    if (writer->format == VIDEO_FORMAT_Y4M) {
+        writer->planes = malloc((size_t) width * height * 3);
+        if (writer->planes == NULL) {
+            video_writer_close(writer);
+            return NULL;
+        }
+        fprintf(writer->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444 XCOLORRANGE=FULL\n", width, height, fps);
+    }
+    return writer;
+}
+
+// Full range BT.601, the same conversion ffmpeg applies for yuvj444p
+static void rgba_to_yuv444(const unsigned char *pixels, size_t n_pixels, unsigned char *planes) {
+    unsigned char *y_plane = planes;
+    unsigned char *u_plane = planes + n_pixels;
+    unsigned char *v_plane = planes + 2 * n_pixels;
+
+    for (size_t i = 0; i < n_pixels; i++) {
+        float r = pixels[4 * i + 0];
+        float g = pixels[4 * i + 1];
+        float b = pixels[4 * i + 2];
+        float y = 0.299f * r + 0.587f * g + 0.114f * b;
+        float u = 128.f - 0.168736f * r - 0.331264f * g + 0.5f * b;
+        float v = 128.f + 0.5f * r - 0.418688f * g - 0.081312f * b;
+        y_plane[i] = (unsigned char) (y < 0.f ? 0.f : y > 255.f ? 255.f : y + 0.5f);
+        u_plane[i] = (unsigned char) (u < 0.f ? 0.f : u > 255.f ? 255.f : u + 0.5f);
+        v_plane[i] = (unsigned char) (v < 0.f ? 0.f : v > 255.f ? 255.f : v + 0.5f);
+    }
+}
+
+bool video_writer_write_frame(VideoWriter *writer, const unsigned char *pixels) {
+    size_t n_pixels = (size_t) writer->width * writer->height;
+
+    if (writer->format == VIDEO_FORMAT_Y4M) {
+        rgba_to_yuv444(pixels, n_pixels, writer->planes);
+        if (fputs("FRAME\n", writer->file) == EOF) return false;
+        return fwrite(writer->planes, 3, n_pixels, writer->file) == n_pixels;
+    }
+    return fwrite(pixels, 4, n_pixels, writer->file) == n_pixels;
+}
+
+void video_writer_close(VideoWriter *writer) {
+    if (writer == NULL) return;
+    if (writer->file == stdout) {
+        fflush(stdout);
+    } else if (writer->file != NULL) {
+        fclose(writer->file);
+    }
+    free(writer->planes);
+    free(writer);
+}
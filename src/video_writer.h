@@ -0,0 +1,20 @@
+#ifndef VIDEO_WRITER_H_
+#define VIDEO_WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    VIDEO_FORMAT_Y4M,       // YUV4MPEG2, 4:4:4, self describing (default for stdout)
+    VIDEO_FORMAT_RGBA,      // raw RGBA8 frames, size and rate have to be passed to the consumer
+} VideoFormat;
+
+typedef struct VideoWriter VideoWriter;
+
+// path "-" streams to stdout, otherwise the format is picked from the extension (.y4m, anything else is raw RGBA)
+VideoWriter *video_writer_open(const char *path, int width, int height, int fps);
+// pixels are width * height tightly packed RGBA8 values, top row first
+bool video_writer_write_frame(VideoWriter *writer, const unsigned char *pixels);
+void video_writer_close(VideoWriter *writer);
+
+#endif // VIDEO_WRITER_H_